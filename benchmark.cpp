@@ -0,0 +1,501 @@
+//---------------------------------------------------------- -
+//Copyright(c) 2020. Tawanda M.Nyoni(hkay dot tee at outlook dot com)
+//
+//This file is part of the Hlib library which is released
+//under the Creative Commons Attribution Non - Commercial
+//2.0 Generic license(CC BY - NC 2.0).
+//
+//See accompanying file CC - BY - NC - 2.0.txt
+//----------------------------------------------------------------------------------
+
+// hlib benchmark
+//
+// the sha-256 backends (scalar, sha-ni and avx2) are timed first, and checked
+// against picosha2's portable code; a mismatch fails the run.
+//
+// every run then fills a fresh database with --rows rows using batched inserts and
+// then times single inserts, primary key lookups, full and sorted scans,
+// updates and deletes. each result is written as one line of JSON.
+//
+// usage: hlib_benchmark [--rows=1000,10000] [--threads=1,4] [--ops=10000]
+//                       [--modes=plain,wal,wal_checkpointer,encrypted,encrypted_wal]
+//                       [--out=file]
+//                       [--hash=1]
+//
+// the encrypted modes are skipped when hlib is not linked against SQLCipher,
+// and a run with failed operations exits with an error.
+// wal_checkpointer runs the wal checkpoints on hlib's background thread.
+
+#include "hlib.h"
+#include "picosha2.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace hlib;
+
+namespace {
+	using clock_ = std::chrono::steady_clock;
+
+	const std::string table_name = "bench";
+	const std::string file_name = "hlib_benchmark.db";
+	const size_t batch_size = 1000;
+
+	struct mode_ {
+		std::string name;
+		bool wal = false;
+		bool encrypted = false;
+		bool checkpointer = false;
+	};
+
+	struct options_ {
+		std::vector<size_t> rows = { 1000, 10000 };
+		std::vector<size_t> threads = { 1, 4 };
+		std::vector<mode_> modes = {
+			{ "plain", false, false },
+			{ "wal", true, false },
+			{ "wal_checkpointer", true, false, true },
+			{ "encrypted", false, true },
+			{ "encrypted_wal", true, true }
+		};
+		size_t ops = 10000;
+		std::string out;
+		bool hash = true;
+	};
+
+	// latencies of the individual operations of one measurement, in microseconds
+	struct result_ {
+		std::string operation;
+		size_t operations = 0;
+		double seconds = 0.0;
+		std::vector<double> latencies;
+	};
+
+	long peak_rss_kb() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+		return 0;
+#else
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			return usage.ru_maxrss;
+		return 0;
+#endif
+	}
+
+	std::vector<size_t> parse_list(const std::string& list) {
+		std::vector<size_t> values;
+		std::stringstream stream(list);
+		std::string item;
+		while (std::getline(stream, item, ','))
+			if (!item.empty())
+				values.push_back(std::stoul(item));
+		return values;
+	}
+
+	bool parse_options(int argc, char* argv[], options_& options) {
+		for (int i = 1; i < argc; i++) {
+			const std::string arg = argv[i];
+			const auto idx = arg.find('=');
+			const std::string name = arg.substr(0, idx);
+			const std::string value = idx == std::string::npos ? "" : arg.substr(idx + 1);
+
+			if (name == "--rows")
+				options.rows = parse_list(value);
+			else
+				if (name == "--threads")
+					options.threads = parse_list(value);
+				else
+					if (name == "--ops")
+						options.ops = std::stoul(value);
+					else
+						if (name == "--out")
+							options.out = value;
+						else
+							if (name == "--hash")
+								options.hash = value != "0";
+							else
+								if (name == "--modes") {
+									std::vector<mode_> modes;
+									std::stringstream stream(value);
+									std::string item;
+									while (std::getline(stream, item, ','))
+										for (const auto& mode : options.modes)
+											if (mode.name == item)
+												modes.push_back(mode);
+									options.modes = modes;
+								}
+								else {
+									std::cerr << "unknown option " << arg << std::endl;
+									return false;
+								}
+		}
+		return true;
+	}
+
+	std::string key(size_t index) {
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "k%012zu", index);
+		return buffer;
+	}
+
+	std::vector<hbase::field_> make_row(size_t index) {
+		return {
+			{ "ID", key(index) },
+			{ "Name", "name" + std::to_string(index % 9973) },
+			{ "Score", std::to_string(index % 1000) },
+			{ "Payload", std::string(64, static_cast<char>('a' + index % 26)) }
+		};
+	}
+
+	void remove_database() {
+		std::remove(file_name.c_str());
+		std::remove((file_name + "-wal").c_str());
+		std::remove((file_name + "-shm").c_str());
+		std::remove((file_name + "-journal").c_str());
+	}
+
+	// run count operations split over threads; each call of operation is timed
+	template <typename Operation>
+	result_ run(const std::string& name,
+		size_t count,
+		size_t threads,
+		Operation operation) {
+		result_ result;
+		result.operation = name;
+		result.operations = count;
+		result.latencies.resize(count);
+
+		std::atomic<size_t> next{ 0 };
+		auto worker = [&]() {
+			size_t index;
+			while ((index = next++) < count) {
+				const auto start = clock_::now();
+				operation(index);
+				result.latencies[index] =
+					std::chrono::duration<double, std::micro>(clock_::now() - start).count();
+			}
+		};
+
+		const auto start = clock_::now();
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < threads; i++)
+			pool.emplace_back(worker);
+		worker();
+		for (auto& thread : pool)
+			thread.join();
+		result.seconds = std::chrono::duration<double>(clock_::now() - start).count();
+
+		return result;
+	}
+
+	double percentile(const std::vector<double>& sorted, double fraction) {
+		if (sorted.empty())
+			return 0.0;
+		const auto idx = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(idx, sorted.size() - 1)];
+	}
+
+	void report(std::ostream& out,
+		const mode_& mode,
+		size_t rows,
+		size_t threads,
+		result_& result,
+		size_t errors) {
+		std::sort(result.latencies.begin(), result.latencies.end());
+
+		out << "{\"operation\":\"" << result.operation << "\""
+			<< ",\"mode\":\"" << mode.name << "\""
+			<< ",\"wal\":" << (mode.wal ? "true" : "false")
+			<< ",\"encrypted\":" << (mode.encrypted ? "true" : "false")
+			<< ",\"checkpointer\":" << (mode.checkpointer ? "true" : "false")
+			<< ",\"rows\":" << rows
+			<< ",\"threads\":" << threads
+			<< ",\"operations\":" << result.operations
+			<< ",\"errors\":" << errors
+			<< ",\"seconds\":" << result.seconds
+			<< ",\"ops_per_second\":" << (result.seconds > 0 ? result.operations / result.seconds : 0.0)
+			<< ",\"p50_us\":" << percentile(result.latencies, 0.5)
+			<< ",\"p99_us\":" << percentile(result.latencies, 0.99)
+			<< ",\"p999_us\":" << percentile(result.latencies, 0.999)
+			<< ",\"peak_rss_kb\":" << peak_rss_kb()
+			<< "}" << std::endl;
+	}
+
+	const char* backend_name(picosha2::backend_t backend) {
+		switch (backend) {
+		case picosha2::backend_t::sha_ni:
+			return "sha_ni";
+		case picosha2::backend_t::avx2:
+			return "avx2";
+		case picosha2::backend_t::scalar:
+		default:
+			return "scalar";
+		}
+	}
+
+	// time every supported sha-256 backend, single messages and batches, and
+	// compare the digests with those of the portable code
+	bool run_hashing(std::ostream& out) {
+		const auto initial_backend = picosha2::hash256_backend();
+
+		std::mt19937_64 random(7);
+		std::vector<std::string> messages(20000);
+		size_t bytes = 0;
+		for (auto& message : messages) {
+			message.resize(random() % 1024);
+			for (auto& c : message)
+				c = static_cast<char>(random());
+			bytes += message.size();
+		}
+
+		// reference digests, through the iterator interface of the portable code
+		picosha2::set_hash256_backend(picosha2::backend_t::scalar);
+		std::vector<std::string> expected(messages.size());
+		for (size_t i = 0; i < messages.size(); i++) {
+			std::vector<picosha2::byte_t> hashed(32);
+			picosha2::hash256(messages[i].begin(), messages[i].end(), hashed.begin(), hashed.end());
+			expected[i] = picosha2::bytes_to_hex_string(hashed);
+		}
+
+		bool matches = true;
+		for (const auto backend : { picosha2::backend_t::scalar, picosha2::backend_t::sha_ni, picosha2::backend_t::avx2 }) {
+			if (!picosha2::set_hash256_backend(backend))
+				continue;
+
+			auto report_hashing = [&](const std::string& operation, double seconds, bool ok) {
+				out << "{\"operation\":\"" << operation << "\""
+					<< ",\"backend\":\"" << backend_name(backend) << "\""
+					<< ",\"messages\":" << messages.size()
+					<< ",\"bytes\":" << bytes
+					<< ",\"seconds\":" << seconds
+					<< ",\"mb_per_second\":" << (seconds > 0 ? bytes / seconds / 1e6 : 0.0)
+					<< ",\"matches_scalar\":" << (ok ? "true" : "false")
+					<< "}" << std::endl;
+				matches = matches && ok;
+			};
+
+			std::vector<std::string> digests(messages.size());
+			auto start = clock_::now();
+			for (size_t i = 0; i < messages.size(); i++)
+				picosha2::hash256_hex_string(messages[i], digests[i]);
+			report_hashing("sha256_single",
+				std::chrono::duration<double>(clock_::now() - start).count(), digests == expected);
+
+			digests.clear();
+			start = clock_::now();
+			picosha2::hash256_hex_string_batch(messages, digests);
+			report_hashing("sha256_batch",
+				std::chrono::duration<double>(clock_::now() - start).count(), digests == expected);
+		}
+
+		picosha2::set_hash256_backend(initial_backend);
+
+		if (!matches)
+			std::cerr << "sha-256 backends do not agree with the portable code" << std::endl;
+		return matches;
+	}
+
+	bool run_configuration(std::ostream& out,
+		const options_& options,
+		const mode_& mode,
+		size_t rows,
+		size_t threads) {
+		remove_database();
+
+		std::string error;
+		hbase db;
+
+		hbase::file_ file;
+		file.name = file_name;
+		file.password = mode.encrypted ? "benchmark" : "";
+
+		hbase::table_ bench;
+		bench.name = table_name;
+		bench.columns = {
+			{ "ID", hbase::column_type_::text_, hbase::constraint_::not_null },
+			{ "Name", hbase::column_type_::text_, hbase::constraint_::not_null },
+			{ "Score", hbase::column_type_::integer_, hbase::constraint_::null },
+			{ "Payload", hbase::column_type_::text_, hbase::constraint_::null }
+		};
+		bench.primary_key = { "ID" };
+		std::vector<hbase::table_> tables = { bench };
+
+		if (!db.connect(file, tables, error)) {
+			std::cerr << "connect: " << error << std::endl;
+			return false;
+		}
+
+		// without a codec the key is ignored and the file would not be encrypted
+		if (mode.encrypted) {
+			hbase::table cipher;
+			if (!db.get_records_using_custom_query(cipher, "PRAGMA cipher_version;", error) || cipher.empty()) {
+				std::cerr << "skipping " << mode.name << ": hlib is not linked against SQLCipher" << std::endl;
+				return true;
+			}
+		}
+
+		if (mode.wal && !db.custom_query("PRAGMA journal_mode=WAL;", error)) {
+			std::cerr << "journal_mode: " << error << std::endl;
+			return false;
+		}
+
+		if (mode.checkpointer && !db.start_checkpoints(hbase::checkpoint_policy_(), error)) {
+			std::cerr << "start_checkpoints: " << error << std::endl;
+			return false;
+		}
+
+		std::atomic<size_t> errors{ 0 };
+		size_t failures = 0;
+		const size_t ops = std::min(options.ops, rows);
+
+		// report a measurement with the errors since the last one
+		auto finish = [&](result_& result, size_t threads) {
+			const size_t count = errors.exchange(0);
+			failures += count;
+			report(out, mode, rows, threads, result, count);
+		};
+
+		// fill the table, batch_size rows per transaction
+		{
+			const size_t batches = (rows + batch_size - 1) / batch_size;
+			auto result = run("insert_row_batched", batches, 1, [&](size_t batch) {
+				std::string error;
+				if (!db.custom_query("BEGIN;", error))
+					errors++;
+				for (size_t i = batch * batch_size; i < std::min(rows, (batch + 1) * batch_size); i++) {
+					auto row = make_row(i);
+					if (!db.insert_row(row, table_name, error))
+						errors++;
+				}
+				if (!db.custom_query("COMMIT;", error))
+					errors++;
+				});
+
+			// report per row rather than per batch
+			result.operations = rows;
+			for (auto& latency : result.latencies)
+				latency /= batch_size;
+			finish(result, 1);
+		}
+
+		{
+			auto result = run("insert_row", ops, threads, [&](size_t index) {
+				std::string error;
+				auto row = make_row(rows + index);
+				if (!db.insert_row(row, table_name, error))
+					errors++;
+				});
+			finish(result, threads);
+		}
+
+		std::mt19937_64 random(42);
+		std::vector<size_t> keys(ops);
+		for (auto& k : keys)
+			k = random() % rows;
+
+		{
+			auto result = run("get_records_by_key", ops, threads, [&](size_t index) {
+				std::error_code error;
+				hbase::table records;
+				if (!db.get_records(records, { { "ID", key(keys[index]) } }, table_name, error))
+					errors++;
+				});
+			finish(result, threads);
+		}
+
+		// whole table reads are expensive, keep the number of rows read bounded
+		const size_t scans = std::max<size_t>(1, std::min<size_t>(20, 1000000 / rows));
+
+		{
+			auto result = run("get_records_full_scan", scans, threads, [&](size_t) {
+				std::string error;
+				hbase::table records;
+				if (!db.get_records(records, table_name, error))
+					errors++;
+				});
+			finish(result, threads);
+		}
+
+		{
+			auto result = run("get_records_sorted_scan", scans, threads, [&](size_t) {
+				std::string error;
+				hbase::table records;
+				if (!db.get_records_with_sort_by(records, { "Score", "" }, table_name, error))
+					errors++;
+				});
+			finish(result, threads);
+		}
+
+		{
+			auto result = run("update_record", ops, threads, [&](size_t index) {
+				std::string error;
+				std::vector<hbase::field_> update = { { "Score", std::to_string(index) } };
+				if (!db.update_record({ "ID", key(keys[index]) }, update, table_name, error))
+					errors++;
+				});
+			finish(result, threads);
+		}
+
+		{
+			auto result = run("delete_row", ops, threads, [&](size_t index) {
+				std::string error;
+				if (!db.delete_row({ "ID", key(index) }, table_name, error))
+					errors++;
+				});
+			finish(result, threads);
+		}
+
+		if (failures) {
+			std::cerr << mode.name << ": " << failures << " operations failed" << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	options_ options;
+	if (!parse_options(argc, argv, options))
+		return 1;
+
+	std::ofstream file;
+	if (!options.out.empty()) {
+		file.open(options.out);
+		if (!file) {
+			std::cerr << "cannot open " << options.out << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = options.out.empty() ? std::cout : file;
+
+	if (options.hash && !run_hashing(out))
+		return 1;
+
+	for (const auto& mode : options.modes)
+		for (const auto rows : options.rows)
+			for (const auto threads : options.threads)
+				if (!run_configuration(out, options, mode, rows, threads))
+					return 1;
+
+	remove_database();
+	return 0;
+}
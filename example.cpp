@@ -1,41 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "hlib.h"
+#include "unique_string.h"
+#ifdef _MSC_VER
 #pragma comment(lib, "hlib.lib")
+#endif
 
 using namespace hlib;
 hbase db;
 
 //printing out the table.
 void out_put(std::string table_name, std::string& error) {
-	std::vector<hbase::row_> rows_;
+	hbase::table rows_;
 	if (!db.get_records(rows_, table_name, error))
 		std::cout << error << " occured!" << std::endl;
 	else
 		for (auto headings : rows_) {
-			for (const auto heading : headings.fields) {
-				std::cout << heading.name << "\t|";
+			for (const auto& heading : headings) {
+				std::cout << heading.first << "\t|";
 			}
 			std::cout << std::endl;
 			break;
 		}
 
 	for (auto row : rows_) {
-		for (auto field : row.fields) {
-			std::cout << field.item + "\t";
+		for (auto field : row) {
+			std::cout << field.second + "\t";
 		}
 		std::cout << std::endl;
 	}
 }
 
+//checking the id generators: ids must be unique, also across threads, and v7
+//uuids and time ordered ids must sort in the order they were made.
+bool check_ids() {
+	const size_t count = 20000;
+	std::set<std::string> ids;
+	std::mutex lock;
+	bool ok = true;
+
+	auto generate = [&]() {
+		std::vector<std::string> made;
+		std::string last_v7, last_short;
+		bool ordered = true;
+
+		for (size_t i = 0; i < count; i++) {
+			const std::string v4 = unique_string();
+			const std::string v7 = unique_string_v7();
+			const std::string id = unique_short_string();
+
+			ordered = ordered && v4.size() == 36 && v4[14] == '4' &&
+				v7.size() == 36 && v7[14] == '7' && id.size() == 16 &&
+				v7 > last_v7 && id > last_short;
+
+			last_v7 = v7;
+			last_short = id;
+			made.insert(made.end(), { v4, v7, id });
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		ok = ok && ordered;
+		ids.insert(made.begin(), made.end());
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++)
+		threads.emplace_back(generate);
+	for (auto& thread : threads)
+		thread.join();
+
+	const std::string uid = custom_uid("user_");
+	ok = ok && ids.size() == 4 * 3 * count && uid.size() == 21 && uid.compare(0, 5, "user_") == 0;
+
+	std::cout << (ok ? "ids are unique and ordered" : "id check failed!") << std::endl;
+	return ok;
+}
+
+//checking the key derivation against the pbkdf2-hmac-sha256 vectors of
+//rfc 7914 (the first 32 bytes of each).
+bool check_key_derivation() {
+	const bool ok =
+		hbase::derive_key("passwd", "salt", 1) ==
+		"55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc" &&
+		hbase::derive_key("Password", "NaCl", 80000) ==
+		"4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56";
+
+	std::cout << (ok ? "key derivation matches rfc 7914" : "key derivation check failed!") << std::endl;
+	return ok;
+}
+
+//checking the change feed over streamed blobs: inserting a blob is one insert
+//and replacing it one update, however many chunks they are written in.
+bool check_blob_changes() {
+	const std::string path = "changes.db";
+	std::remove(path.c_str());
+
+	std::string error;
+	bool ok;
+	std::vector<std::vector<hbase::change_>> batches;
+	{
+		hbase changes_db;
+		hbase::file_ file;
+		file.name = path;
+
+		hbase::table_ files;
+		files.name = "files";
+		files.columns = {
+			{"Name", hbase::column_type_::text_, hbase::constraint_::not_null},
+			{"Data", hbase::column_type_::blob_, hbase::constraint_::null}
+		};
+		files.primary_key = { "Name" };
+		std::vector<hbase::table_> tables = { files };
+
+		std::mutex lock;
+		std::condition_variable delivered;
+		int subscription = 0;
+
+		auto writer = [](unsigned char* buffer, size_t size) {
+			std::fill(buffer, buffer + size, static_cast<unsigned char>('x'));
+			return size;
+		};
+
+		// four chunks each
+		const size_t size = 200000;
+		ok = changes_db.connect(file, tables, error) &&
+			changes_db.subscribe([&](const std::vector<hbase::change_>& changes) {
+				std::lock_guard<std::mutex> guard(lock);
+				batches.push_back(changes);
+				delivered.notify_one();
+				}, subscription, error) &&
+			changes_db.insert_blob({ { "Name", "a" } }, "Data", size, writer, files.name, error) &&
+			changes_db.write_blob({ "Name", "a" }, "Data", size, writer, files.name, error);
+
+		std::unique_lock<std::mutex> guard(lock);
+		delivered.wait_for(guard, std::chrono::seconds(5), [&]() { return batches.size() >= 2; });
+	}
+	std::remove(path.c_str());
+
+	auto is = [&](size_t batch, hbase::change_operation_ operation) {
+		return batches[batch].size() == 1 && batches[batch][0].operation == operation &&
+			batches[batch][0].table_name == "files";
+	};
+	ok = ok && batches.size() == 2 &&
+		is(0, hbase::change_operation_::insert_) && is(1, hbase::change_operation_::update_);
+
+	std::cout << (ok ? "blob writes are one change each" : "blob change check failed! " + error) << std::endl;
+	return ok;
+}
+
 int main() {
 	std::string error;
+
+	if (!check_ids() || !check_key_derivation() || !check_blob_changes())
+		return 1;
   
   //printing out the error.
 	auto on_error = [](std::string& error) { std::cout << error << "occured!" << std::endl; };
 
-	hbase::database_file_ file = { "test.db", "pass" };
-	hbase::tables_ tables;
+	hbase::file_ file;
+	file.name = "test.db";
+	file.password = "pass";
+	std::vector<hbase::table_> tables;
 
   //creating the tables.
 	hbase::table_ users;
@@ -45,32 +177,28 @@ int main() {
 		{"Username", hbase::column_type_::text_, hbase::constraint_::not_null},
 		{"User_type", hbase::column_type_::text_, hbase::constraint_::null}
 	};
-	users.primary_key = "ID";
-	tables.add(users);
+	users.primary_key = { "ID" };
+	tables.push_back(users);
 
   //connecting to the database.
 	if (!db.connect(file, tables, error)) {
 		on_error(error);
-		return 0;
+		return 1;
 	}
 	else
 		std::cout << "database connected successfully!" << std::endl;
 
-	std::vector<hbase::row_> rows;
-	hbase::row_ row0 = {
-		{
-			{ {"ID"}, {"n145"} },
-			{ {"Username"}, {"User3"} },
-			{ {"User_type"}, {"guest"} }
-		}
+	std::vector<std::vector<hbase::field_>> rows;
+	std::vector<hbase::field_> row0 = {
+		{ {"ID"}, {"n145"} },
+		{ {"Username"}, {"User3"} },
+		{ {"User_type"}, {"guest"} }
 	};
 
-	hbase::row_ row1 = {
-		{
-			{ {"ID"}, {"3453hk"} },
-			{ {"Username"}, {"User7"} },
-			{ {"User_type"}, {"Guest"} }
-		}
+	std::vector<hbase::field_> row1 = {
+		{ {"ID"}, {"3453hk"} },
+		{ {"Username"}, {"User7"} },
+		{ {"User_type"}, {"Guest"} }
 	};
 
 	rows.push_back(row0);
@@ -96,16 +224,14 @@ int main() {
 	else
 		std::cout << "deleted successfully" << std::endl;
 
-	hbase::row_ update = {
-		{
-			{ {"ID"}, {"n00r"} },
-			{ {"Username"}, {"Hkay"} },
-			{ {"User_type"}, {"Guest"} }
-		}
+	std::vector<hbase::field_> update = {
+		{ {"ID"}, {"n00r"} },
+		{ {"Username"}, {"Hkay"} },
+		{ {"User_type"}, {"Guest"} }
 	};
   
 	out_put(users.name, error);
-	if (!db.update_record(row0, update, users.name, error))
+	if (!db.update_record(row0[0], update, users.name, error))
 		std::cout << error << " occurred!" << std::endl;
 	else
 		std::cout << "updated successfully!" << std::endl;
@@ -0,0 +1,585 @@
+//---------------------------------------------------------- -
+//Copyright(c) 2020. Tawanda M.Nyoni(hkay dot tee at outlook dot com)
+//
+//This file is part of the Hlib library which is released
+//under the Creative Commons Attribution Non - Commercial
+//2.0 Generic license(CC BY - NC 2.0).
+//
+//See accompanying file CC - BY - NC - 2.0.txt
+//----------------------------------------------------------------------------------
+
+#include "hlib.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <queue>
+
+using namespace hlib;
+
+namespace {
+	// fnv-1a over the key values, with a separator so that ("ab", "c") and
+	// ("a", "bc") hash differently. it must never change: it decides where rows
+	// already in the shards are
+	std::uint64_t hash_key(const std::vector<const std::string*>& values) {
+		std::uint64_t hash = 14695981039346656037ULL;
+		for (const auto value : values) {
+			for (const char c : *value) {
+				hash ^= static_cast<unsigned char>(c);
+				hash *= 1099511628211ULL;
+			}
+			hash ^= 0x1F;
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// the value sqlite stores for text put in an integer or float column: a
+	// decimal number (white space around it is allowed) becomes a number, so
+	// 1, 01, +1 and 1.0 are the same key. numbers are written as integers when
+	// they are whole and otherwise in the fewest digits that read back the
+	// same, which leaves keys that are already in that form, and so the shard
+	// of every such row, as they were. other text is kept
+	std::string numeric_key(const std::string& value) {
+		size_t begin = 0, end = value.size();
+		while (begin < end && isspace(static_cast<unsigned char>(value[begin])))
+			begin++;
+		while (end > begin && isspace(static_cast<unsigned char>(value[end - 1])))
+			end--;
+
+		// [+-] digits [. digits] [e [+-] digits], with digits on at least one
+		// side of the point. hex, inf and nan stay text in sqlite
+		size_t i = begin, digits = 0;
+		if (i < end && (value[i] == '+' || value[i] == '-'))
+			i++;
+		while (i < end && isdigit(static_cast<unsigned char>(value[i])))
+			i++, digits++;
+		const bool integer = i == end;
+		if (i < end && value[i] == '.')
+			for (i++; i < end && isdigit(static_cast<unsigned char>(value[i])); i++)
+				digits++;
+		if (digits && i < end && (value[i] == 'e' || value[i] == 'E')) {
+			i++;
+			if (i < end && (value[i] == '+' || value[i] == '-'))
+				i++;
+			const size_t exponent = i;
+			while (i < end && isdigit(static_cast<unsigned char>(value[i])))
+				i++;
+			if (i == exponent)
+				return value;
+		}
+		if (!digits || i != end)
+			return value;
+
+		const std::string number = value.substr(begin, end - begin);
+		char buffer[32];
+
+		// integers that fit are exact, bigger ones become reals like in sqlite
+		if (integer) {
+			errno = 0;
+			const long long whole = std::strtoll(number.c_str(), nullptr, 10);
+			if (errno != ERANGE) {
+				snprintf(buffer, sizeof(buffer), "%lld", whole);
+				return buffer;
+			}
+		}
+
+		double real = std::strtod(number.c_str(), nullptr);
+		if (real == 0)
+			real = 0;	// -0 is 0
+
+		if (std::isfinite(real) && real >= -9223372036854775808.0 && real < 9223372036854775808.0 &&
+			static_cast<double>(static_cast<long long>(real)) == real) {
+			snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(real));
+			return buffer;
+		}
+
+		snprintf(buffer, sizeof(buffer), "%.15g", real);
+		if (std::strtod(buffer, nullptr) != real)
+			snprintf(buffer, sizeof(buffer), "%.17g", real);
+		return buffer;
+	}
+}
+
+class hlib::hbase_sharded::hbase_sharded_impl {
+	friend hbase_sharded;
+
+	struct shard {
+		hbase db;
+
+		// one caller at a time, so that a batch can have the shard's
+		// connection to itself for its transaction and reads do not see a
+		// batch that has not committed
+		std::mutex lock;
+	};
+
+	bool connected_ = false;
+	std::vector<std::unique_ptr<shard>> shards_;
+	std::map<std::string, table_> tables_;
+
+public:
+	const table_* find_table(const std::string& table_name,
+		std::string& error) {
+		auto it = tables_.find(table_name);
+		if (it == tables_.end()) {
+			error = "Unknown table " + table_name;
+			return nullptr;
+		}
+		return &it->second;
+	}
+
+	// the shard a row belongs to, if fields has a value for every primary key
+	// column of the table
+	bool shard_of(const table_& table_,
+		const std::vector<field_>& fields,
+		size_t& shard) {
+		if (table_.primary_key.empty())
+			return false;
+
+		// numbers in the form sqlite stores them, so that equal keys meet.
+		// reserved, so the pointers into it stay valid
+		std::vector<std::string> numbers;
+		numbers.reserve(table_.primary_key.size());
+
+		std::vector<const std::string*> values;
+		values.reserve(table_.primary_key.size());
+		for (const auto& key : table_.primary_key) {
+			auto it = std::find_if(fields.begin(), fields.end(),
+				[&key](const field_& field) { return field.name == key; });
+			if (it == fields.end())
+				return false;
+
+			auto column = std::find_if(table_.columns.begin(), table_.columns.end(),
+				[&key](const hbase::column_& col) { return col.name == key; });
+			if (column != table_.columns.end() &&
+				(column->type == hbase::column_type_::integer_ || column->type == hbase::column_type_::float_)) {
+				numbers.push_back(numeric_key(it->value));
+				values.push_back(&numbers.back());
+			}
+			else
+				values.push_back(&it->value);
+		}
+
+		shard = static_cast<size_t>(hash_key(values) % shards_.size());
+		return true;
+	}
+
+	// runs task on every shard, the first on this thread and the others on
+	// threads of their own, and waits for all of them
+	bool for_each_shard(const std::function<bool(size_t shard, std::string& error)>& task,
+		std::string& error) {
+		const size_t count = shards_.size();
+		std::vector<std::string> errors(count);
+
+		std::vector<std::future<bool>> results;
+		results.reserve(count);
+		for (size_t i = 1; i < count; i++)
+			results.push_back(std::async(std::launch::async,
+				[&task, &errors, i]() { return task(i, errors[i]); }));
+
+		bool success = task(0, errors[0]);
+		if (!success)
+			error = errors[0];
+
+		for (size_t i = 1; i < count; i++)
+			if (!results[i - 1].get() && success) {
+				success = false;
+				error = errors[i];
+			}
+
+		return success;
+	}
+
+	// runs a query that returns rows on every shard
+	bool gather(std::vector<table>& results,
+		const std::function<bool(hbase& db, table& records, std::string& error)>& query,
+		std::string& error) {
+		results.assign(shards_.size(), table());
+
+		return for_each_shard([&](size_t shard, std::string& error) {
+			std::lock_guard<std::mutex> lock(shards_[shard]->lock);
+			return query(shards_[shard]->db, results[shard], error);
+			}, error);
+	}
+
+	bool insert_rows(shard& shard,
+		std::vector<const std::vector<field_>*>& rows,
+		const std::string& table_name,
+		std::string& error) {
+		std::lock_guard<std::mutex> lock(shard.lock);
+
+		if (!shard.db.custom_query("BEGIN;", error))
+			return false;
+
+		for (auto row : rows)
+			if (!shard.db.insert_row(*row, table_name, error)) {
+				std::string rollback_error;
+				shard.db.custom_query("ROLLBACK;", rollback_error);
+				return false;
+			}
+
+		return shard.db.custom_query("COMMIT;", error);
+	}
+};
+
+bool hlib::hbase_sharded::connect(const std::vector<file_>& files,
+	std::vector<table_>& tables,
+	std::string& error) {
+
+	if (d_.connected_)
+		return true;
+
+	if (files.empty()) {
+		error = "No shards";
+		return false;
+	}
+
+	std::vector<std::unique_ptr<hbase_sharded_impl::shard>> shards;
+	for (const auto& file : files) {
+		shards.emplace_back(new hbase_sharded_impl::shard());
+		if (!shards.back()->db.connect(file, tables, error)) {
+			error = file.name + ": " + error;
+			return false;
+		}
+	}
+
+	d_.shards_ = std::move(shards);
+	for (const auto& table_ : tables)
+		d_.tables_[table_.name] = table_;
+
+	d_.connected_ = true;
+	return true;
+}
+
+size_t hlib::hbase_sharded::shard_count() const {
+	return d_.shards_.size();
+}
+
+bool hlib::hbase_sharded::insert_row(const std::vector<field_>& row,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	const table_* table_ = d_.find_table(table_name, error);
+	if (!table_)
+		return false;
+
+	size_t shard;
+	if (!d_.shard_of(*table_, row, shard)) {
+		error = "The row has no value for the primary key of " + table_name;
+		return false;
+	}
+
+	auto& target = *d_.shards_[shard];
+	std::lock_guard<std::mutex> lock(target.lock);
+	return target.db.insert_row(row, table_name, error);
+}
+
+bool hlib::hbase_sharded::insert_rows(const std::vector<std::vector<field_>>& rows,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	const table_* table_ = d_.find_table(table_name, error);
+	if (!table_)
+		return false;
+
+	std::vector<std::vector<const std::vector<field_>*>> shard_rows(d_.shards_.size());
+	for (auto& row : rows) {
+		size_t shard;
+		if (!d_.shard_of(*table_, row, shard)) {
+			error = "A row has no value for the primary key of " + table_name;
+			return false;
+		}
+		shard_rows[shard].push_back(&row);
+	}
+
+	return d_.for_each_shard([&](size_t shard, std::string& error) {
+		return shard_rows[shard].empty() ||
+			d_.insert_rows(*d_.shards_[shard], shard_rows[shard], table_name, error);
+		}, error);
+}
+
+bool hlib::hbase_sharded::delete_row(const field_& field,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	const table_* table_ = d_.find_table(table_name, error);
+	if (!table_)
+		return false;
+
+	size_t shard;
+	if (d_.shard_of(*table_, { field }, shard)) {
+		auto& target = *d_.shards_[shard];
+		std::lock_guard<std::mutex> lock(target.lock);
+		return target.db.delete_row(field, table_name, error);
+	}
+
+	return d_.for_each_shard([&](size_t shard, std::string& error) {
+		auto& target = *d_.shards_[shard];
+		std::lock_guard<std::mutex> lock(target.lock);
+		return target.db.delete_row(field, table_name, error);
+		}, error);
+}
+
+bool hlib::hbase_sharded::count_records(const field_& field,
+	const std::string& table_name,
+	size_t& records,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	const table_* table_ = d_.find_table(table_name, error);
+	if (!table_)
+		return false;
+
+	size_t shard;
+	if (d_.shard_of(*table_, { field }, shard)) {
+		auto& target = *d_.shards_[shard];
+		std::lock_guard<std::mutex> lock(target.lock);
+		return target.db.count_records(field, table_name, records, error);
+	}
+
+	std::vector<size_t> counts(d_.shards_.size(), 0);
+	if (!d_.for_each_shard([&](size_t shard, std::string& error) {
+		std::lock_guard<std::mutex> lock(d_.shards_[shard]->lock);
+		return d_.shards_[shard]->db.count_records(field, table_name, counts[shard], error);
+		}, error))
+		return false;
+
+	records = 0;
+	for (const auto count : counts)
+		records += count;
+	return true;
+}
+
+bool hlib::hbase_sharded::count_records(const std::string& table_name,
+	size_t& records,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	std::vector<size_t> counts(d_.shards_.size(), 0);
+	if (!d_.for_each_shard([&](size_t shard, std::string& error) {
+		std::lock_guard<std::mutex> lock(d_.shards_[shard]->lock);
+		return d_.shards_[shard]->db.count_records(table_name, counts[shard], error);
+		}, error))
+		return false;
+
+	records = 0;
+	for (const auto count : counts)
+		records += count;
+	return true;
+}
+
+bool hlib::hbase_sharded::get_records(table& records,
+	const std::vector<field_>& compound_keys,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	const table_* table_ = d_.find_table(table_name, error);
+	if (!table_)
+		return false;
+
+	size_t shard;
+	if (d_.shard_of(*table_, compound_keys, shard)) {
+		auto& target = *d_.shards_[shard];
+		std::lock_guard<std::mutex> lock(target.lock);
+		return target.db.get_records(records, compound_keys, table_name, error);
+	}
+
+	std::vector<table> results;
+	if (!d_.gather(results, [&](hbase& db, table& records, std::string& error) {
+		return db.get_records(records, compound_keys, table_name, error);
+		}, error))
+		return false;
+
+	for (auto& result : results)
+		std::move(result.begin(), result.end(), std::back_inserter(records));
+	return true;
+}
+
+bool hlib::hbase_sharded::get_records(table& records,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	std::vector<table> results;
+	if (!d_.gather(results, [&](hbase& db, table& records, std::string& error) {
+		return db.get_records(records, table_name, error);
+		}, error))
+		return false;
+
+	for (auto& result : results)
+		std::move(result.begin(), result.end(), std::back_inserter(records));
+	return true;
+}
+
+bool hlib::hbase_sharded::get_records_with_sort_by(table& records,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	if (!d_.find_table(table_name, error))
+		return false;
+
+	// each row comes with the storage class of its value, which sqlite sorts
+	// by first: NULL, then numbers by value, then text and blobs by their
+	// bytes. an empty string and a NULL look the same in a row
+	const std::string sort_type = "hlib_sort_type";
+	const std::string sql = "SELECT *, typeof(" + sort_by_field.name + ") AS " + sort_type + " FROM " +
+		table_name + " ORDER BY " + sort_by_field.name + ";";
+
+	std::vector<table> results;
+	if (!d_.gather(results, [&](hbase& db, table& records, std::string& error) {
+		return db.get_records_using_custom_query(records, sql, error);
+		}, error))
+		return false;
+
+	struct sort_key_ {
+		int rank = 0;
+		bool integer = false;
+		const std::string* value = nullptr;
+	};
+
+	const std::string none;
+	auto key = [&](size_t shard, size_t row) {
+		auto& values = results[shard][row];
+		auto it = values.find(sort_by_field.name);
+		const std::string& type = values[sort_type];
+
+		sort_key_ key;
+		key.rank = type == "null" ? 0 : type == "integer" || type == "real" ? 1 : type == "text" ? 2 : 3;
+		key.integer = type == "integer";
+		key.value = it == values.end() ? &none : &it->second;
+		return key;
+	};
+
+	auto less = [](const sort_key_& a, const sort_key_& b) {
+		if (a.rank != b.rank)
+			return a.rank < b.rank;
+		if (a.rank != 1)
+			return *a.value < *b.value;
+
+		// integers past 2^53 are compared exactly
+		if (a.integer && b.integer)
+			return std::strtoll(a.value->c_str(), nullptr, 10) < std::strtoll(b.value->c_str(), nullptr, 10);
+		return std::strtod(a.value->c_str(), nullptr) < std::strtod(b.value->c_str(), nullptr);
+	};
+
+	// k-way merge of the sorted shard results. (shard, row) pairs, smallest
+	// value on top and ties in shard order
+	using cursor = std::pair<size_t, size_t>;
+	auto after = [&](const cursor& a, const cursor& b) {
+		const auto key_a = key(a.first, a.second);
+		const auto key_b = key(b.first, b.second);
+		if (less(key_b, key_a))
+			return true;
+		if (less(key_a, key_b))
+			return false;
+		return a.first > b.first;
+	};
+
+	std::priority_queue<cursor, std::vector<cursor>, decltype(after)> heads(after);
+	size_t total = 0;
+	for (size_t shard = 0; shard < results.size(); shard++) {
+		total += results[shard].size();
+		if (!results[shard].empty())
+			heads.push({ shard, 0 });
+	}
+
+	records.reserve(records.size() + total);
+	while (!heads.empty()) {
+		const cursor head = heads.top();
+		heads.pop();
+
+		records.push_back(std::move(results[head.first][head.second]));
+		records.back().erase(sort_type);
+		if (head.second + 1 < results[head.first].size())
+			heads.push({ head.first, head.second + 1 });
+	}
+
+	return true;
+}
+
+bool hlib::hbase_sharded::update_record(const field_& field,
+	const std::vector<field_>& row_update,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	const table_* table_ = d_.find_table(table_name, error);
+	if (!table_)
+		return false;
+
+	for (const auto& update : row_update)
+		if (std::find(table_->primary_key.begin(), table_->primary_key.end(), update.name) != table_->primary_key.end()) {
+			error = "Cannot update " + update.name + ", it is part of the primary key of " + table_name;
+			return false;
+		}
+
+	size_t shard;
+	if (d_.shard_of(*table_, { field }, shard)) {
+		auto& target = *d_.shards_[shard];
+		std::lock_guard<std::mutex> lock(target.lock);
+		return target.db.update_record(field, row_update, table_name, error);
+	}
+
+	return d_.for_each_shard([&](size_t shard, std::string& error) {
+		auto& target = *d_.shards_[shard];
+		std::lock_guard<std::mutex> lock(target.lock);
+		return target.db.update_record(field, row_update, table_name, error);
+		}, error);
+}
+
+hlib::hbase_sharded::hbase_sharded() :
+	d_(*new hbase_sharded_impl()) {}
+
+hlib::hbase_sharded::~hbase_sharded() {
+	delete& d_;
+}
@@ -36,267 +36,4470 @@
 #include "sqlite3.h"
 #include "picosha2.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
 using table = std::vector<std::map<std::string, std::string>>;
 
-class hlib::hbase::hbase_impl {
-	friend hbase;
+namespace {
+	using clock_ = std::chrono::steady_clock;
+
+	// measures the time between successive calls to lap(); does nothing when
+	// disabled so that uninstrumented queries do not read the clock at all
+	class stopwatch {
+		bool enabled_;
+		clock_::time_point last_;
+
+	public:
+		explicit stopwatch(bool enabled) :
+			enabled_(enabled) {
+			if (enabled_)
+				last_ = clock_::now();
+		}
+
+		long long lap() {
+			if (!enabled_)
+				return 0;
+
+			const auto now = clock_::now();
+			const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+			last_ = now;
+			return elapsed;
+		}
+	};
+
+	// log-linear latency histogram over nanoseconds: every power of two is split
+	// into sub_buckets linear buckets, which keeps the error below 1/sub_buckets
+	class latency_histogram {
+		static const int sub_bucket_bits = 4;
+		static const int sub_buckets = 1 << sub_bucket_bits;
+		static const int magnitudes = 64 - sub_bucket_bits;
+
+		static const int buckets = (magnitudes + 1) * sub_buckets;
+
+		unsigned long long counts_[buckets] = {};
+		unsigned long long total_ = 0;
+
+		static int index_of(unsigned long long value) {
+			int magnitude = 0;
+			while ((value >> magnitude) >= 2 * sub_buckets)
+				magnitude++;
+
+			if (magnitude == 0)
+				return static_cast<int>(value);
+
+			return (magnitude + 1) * sub_buckets + static_cast<int>((value >> magnitude) - sub_buckets);
+		}
+
+		static unsigned long long value_of(int index) {
+			if (index < 2 * sub_buckets)
+				return index;
+
+			const int magnitude = index / sub_buckets - 1;
+			const unsigned long long sub = index % sub_buckets + sub_buckets;
+
+			// upper edge of the bucket
+			return ((sub + 1) << magnitude) - 1;
+		}
+
+	public:
+		void add(long long value) {
+			if (value < 0)
+				value = 0;
+
+			counts_[index_of(static_cast<unsigned long long>(value))]++;
+			total_++;
+		}
+
+		// value below which the given fraction of the samples lie
+		unsigned long long percentile(double fraction) const {
+			if (total_ == 0)
+				return 0;
+
+			const auto target = static_cast<unsigned long long>(fraction * total_ + 0.5);
+			unsigned long long seen = 0;
+			for (int index = 0; index < buckets; index++) {
+				seen += counts_[index];
+				if (seen >= target && seen > 0)
+					return value_of(index);
+			}
+			return value_of(buckets - 1);
+		}
+	};
+
+	// sha-256 of message, continuing from a state that has already hashed
+	// prefix_length bytes (a multiple of 64)
+	void sha256_from_state(std::uint32_t state[8],
+		size_t prefix_length,
+		const picosha2::byte_t* message,
+		size_t length,
+		picosha2::byte_t digest[32]) {
+		const auto compress = picosha2::detail::dispatch().compress;
+
+		if (length / 64)
+			compress(state, message, length / 64);
+
+		picosha2::byte_t tail[128] = {};
+		const size_t remains = length % 64;
+		std::copy(message + length - remains, message + length, tail);
+		tail[remains] = 0x80;
+
+		const size_t blocks = remains > 55 ? 2 : 1;
+		const unsigned long long bits = (prefix_length + length) * 8ULL;
+		for (int i = 0; i < 8; i++)
+			tail[blocks * 64 - 1 - i] = static_cast<picosha2::byte_t>(bits >> (8 * i));
+		compress(state, tail, blocks);
+
+		for (int i = 0; i < 8; i++)
+			picosha2::detail::store_be32(state[i], digest + 4 * i);
+	}
+
+	// pbkdf2-hmac-sha256 with a 32 byte output, as hex
+	std::string pbkdf2_sha256(const std::string& password,
+		const std::string& salt,
+		int iterations) {
+		using picosha2::byte_t;
+
+		byte_t key[64] = {};
+		if (password.length() > 64)
+			picosha2::hash256(password.begin(), password.end(), key, key + 32);
+		else
+			std::copy(password.begin(), password.end(), key);
+
+		// the states after hashing the padded key, shared by every hmac
+		byte_t pad[64];
+		std::uint32_t inner[8], outer[8];
+		for (int i = 0; i < 8; i++)
+			inner[i] = outer[i] = static_cast<std::uint32_t>(picosha2::detail::initial_message_digest[i]);
+
+		for (int i = 0; i < 64; i++) pad[i] = key[i] ^ 0x36;
+		picosha2::detail::dispatch().compress(inner, pad, 1);
+		for (int i = 0; i < 64; i++) pad[i] = key[i] ^ 0x5c;
+		picosha2::detail::dispatch().compress(outer, pad, 1);
+
+		auto hmac = [&](const byte_t* message, size_t length, byte_t digest[32]) {
+			std::uint32_t state[8];
+			byte_t inner_digest[32];
+			std::copy(inner, inner + 8, state);
+			sha256_from_state(state, 64, message, length, inner_digest);
+			std::copy(outer, outer + 8, state);
+			sha256_from_state(state, 64, inner_digest, 32, digest);
+		};
+
+		// first block only: u1 = hmac(salt || 00000001)
+		std::vector<byte_t> first(salt.begin(), salt.end());
+		first.insert(first.end(), { 0, 0, 0, 1 });
+
+		byte_t u[32], result[32];
+		hmac(first.data(), first.size(), u);
+		std::copy(u, u + 32, result);
+
+		for (int i = 1; i < iterations; i++) {
+			hmac(u, 32, u);
+			for (int j = 0; j < 32; j++)
+				result[j] ^= u[j];
+		}
+
+		return picosha2::bytes_to_hex_string(result, result + 32);
+	}
+
+	// hlib_row_hash(types, column, ...): the first 128 bits, as hex, of the
+	// sha-256 of a canonical serialization of the columns. every value is written
+	// as T<length>:<text> and NULL as N, so that no two rows serialize the same.
+	// types has a letter for every column (t text, i integer, r real, b blob),
+	// and values are hashed the way a column of that type stores them, so the
+	// literals of an insert hash the same as the row read back
+	void row_hash_function(sqlite3_context* context, int argc, sqlite3_value** argv) {
+		const char* types = argc > 0 ? reinterpret_cast<const char*>(sqlite3_value_text(argv[0])) : nullptr;
+		if (!types || sqlite3_value_bytes(argv[0]) != argc - 1) {
+			sqlite3_result_error(context, "hlib_row_hash needs a type for every column", -1);
+			return;
+		}
+
+		std::string serialized;
+		for (int i = 1; i < argc; i++) {
+			sqlite3_value* value = argv[i];
+			if (sqlite3_value_type(value) == SQLITE_NULL) {
+				serialized += 'N';
+				continue;
+			}
+
+			// numeric affinity, with integral reals stored as integers in integer
+			// columns and integers as reals in real columns
+			std::string number;
+			const char type = types[i - 1];
+			if (type == 'i' || type == 'r') {
+				const int numeric = sqlite3_value_numeric_type(value);
+				const double real = sqlite3_value_double(value);
+
+				if (type == 'i' && numeric == SQLITE_FLOAT && real >= -9223372036854775808.0 &&
+					real < 9223372036854775808.0 && static_cast<double>(static_cast<long long>(real)) == real)
+					number = std::to_string(static_cast<long long>(real));
+
+				if (type == 'r' && numeric == SQLITE_INTEGER) {
+					char* text = sqlite3_mprintf("%!.15g", real);
+					number = text ? text : "";
+					sqlite3_free(text);
+				}
+			}
+
+			if (!number.empty()) {
+				serialized += 'T' + std::to_string(number.length()) + ':' + number;
+				continue;
+			}
+
+			const char* text = reinterpret_cast<const char*>(sqlite3_value_text(value));
+			const int length = sqlite3_value_bytes(value);
+			serialized += 'T' + std::to_string(length) + ':';
+			serialized.append(text ? text : "", text ? length : 0);
+		}
+
+		std::string hash;
+		picosha2::hash256_hex_string(serialized, hash);
+		hash.resize(32);
+		sqlite3_result_text(context, hash.c_str(), static_cast<int>(hash.length()), SQLITE_TRANSIENT);
+	}
+
+	// replace literals with ? and collapse white space so that statements which
+	// only differ in their values are counted together. the literals can be
+	// kept, in order, as (is text, value) with string literals unquoted
+	std::string normalize_statement(const std::string& query,
+		std::vector<std::pair<bool, std::string>>* literals = nullptr) {
+		std::string shape;
+		shape.reserve(query.size());
+
+		auto is_word = [](char c) {
+			return isalnum(static_cast<unsigned char>(c)) || c == '_';
+		};
+
+		auto is_from = [](const std::string& word) {
+			std::string upper(word);
+			for (auto& c : upper) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+			return upper == "FROM ";
+		};
+
+		for (size_t i = 0; i < query.size(); i++) {
+			const char c = query[i];
+
+			if (c == '\'') {
+				// string literal, '' is an escaped quote
+				const size_t begin = i;
+				while (++i < query.size())
+					if (query[i] == '\'') {
+						if (i + 1 < query.size() && query[i + 1] == '\'')
+							i++;
+						else
+							break;
+					}
+
+				// a quoted table name is part of the shape
+				if (shape.size() >= 5 && is_from(shape.substr(shape.size() - 5)))
+					shape += query.substr(begin, i - begin + 1);
+				else {
+					shape += '?';
+
+					if (literals) {
+						std::string text;
+						for (size_t j = begin + 1; j < i && j < query.size(); j++) {
+							text += query[j];
+							if (query[j] == '\'' && j + 1 < i)
+								j++;
+						}
+						literals->emplace_back(true, text);
+					}
+				}
+			}
+			else
+				if (isdigit(static_cast<unsigned char>(c)) && (shape.empty() || !is_word(shape.back()))) {
+					// numeric literal
+					const size_t begin = i;
+					while (i + 1 < query.size() && (is_word(query[i + 1]) || query[i + 1] == '.'))
+						i++;
+					shape += '?';
+
+					if (literals)
+						literals->emplace_back(false, query.substr(begin, i - begin + 1));
+				}
+				else
+					if (isspace(static_cast<unsigned char>(c))) {
+						if (!shape.empty() && shape.back() != ' ')
+							shape += ' ';
+					}
+					else
+						shape += c;
+		}
+
+		while (!shape.empty() && shape.back() == ' ')
+			shape.pop_back();
+
+		return shape;
+	}
+
+	std::string to_upper(std::string text) {
+		for (auto& c : text) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+		return text;
+	}
+
+	// the columns a statement compares with =, IS or IN (equality), with <, >
+	// or BETWEEN (range), and those it orders or groups by, with DESC kept
+	struct statement_columns {
+		std::vector<std::string> equality;
+		std::vector<std::string> range;
+		std::vector<std::string> order;
+	};
+
+	statement_columns parse_statement_columns(const std::string& statement) {
+		// words (t.column is one word), runs of comparison operators and
+		// single characters, outside of string literals
+		std::vector<std::string> tokens;
+		for (size_t i = 0; i < statement.size(); i++) {
+			const char c = statement[i];
+			auto is_word = [](char c) {
+				return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+			};
+
+			if (isspace(static_cast<unsigned char>(c)) || c == '"' || c == '`' || c == '[' || c == ']')
+				continue;
+
+			if (c == '\'') {
+				while (++i < statement.size() && statement[i] != '\'');
+				tokens.push_back("?");
+			}
+			else
+				if (is_word(c)) {
+					const size_t begin = i;
+					while (i + 1 < statement.size() && is_word(statement[i + 1]))
+						i++;
+					tokens.push_back(statement.substr(begin, i - begin + 1));
+				}
+				else
+					if (c == '<' || c == '>' || c == '=' || c == '!') {
+						const size_t begin = i;
+						while (i + 1 < statement.size() && std::strchr("<>=!", statement[i + 1]))
+							i++;
+						tokens.push_back(statement.substr(begin, i - begin + 1));
+					}
+					else
+						tokens.push_back(std::string(1, c));
+		}
+
+		auto column_name = [](const std::string& word) {
+			const size_t dot = word.rfind('.');
+			return dot == std::string::npos ? word : word.substr(dot + 1);
+		};
+
+		auto add = [](std::vector<std::string>& columns, const std::string& column) {
+			if (std::find(columns.begin(), columns.end(), column) == columns.end())
+				columns.push_back(column);
+		};
+
+		static const std::vector<std::string> keywords = { "AND", "OR", "NOT", "ASC", "DESC",
+			"COLLATE", "NULLS", "FIRST", "LAST", "NULL", "IS", "IN", "BETWEEN", "LIKE" };
+
+		enum class clause { other, where, order };
+		clause current = clause::other;
+		statement_columns columns;
+
+		for (size_t i = 0; i < tokens.size(); i++) {
+			const std::string word = to_upper(tokens[i]);
+			const std::string next = i + 1 < tokens.size() ? to_upper(tokens[i + 1]) : "";
+
+			if (word == "WHERE")
+				current = clause::where;
+			else
+				if ((word == "ORDER" || word == "GROUP") && next == "BY") {
+					current = clause::order;
+					i++;
+				}
+				else
+					if (word == "LIMIT" || word == "HAVING" || word == ";" || word == "SELECT" || word == "FROM")
+						current = clause::other;
+					else
+						if (isalpha(static_cast<unsigned char>(word[0])) || word[0] == '_') {
+							if (std::find(keywords.begin(), keywords.end(), word) != keywords.end())
+								continue;
+
+							if (current == clause::where) {
+								if (next == "=" || next == "==" || next == "IS" || next == "IN")
+									add(columns.equality, column_name(tokens[i]));
+								else
+									if (next == "<" || next == ">" || next == "<=" || next == ">=" || next == "BETWEEN")
+										add(columns.range, column_name(tokens[i]));
+							}
+							else
+								if (current == clause::order && (next.empty() || next == "," || next == "ASC" ||
+									next == "DESC" || next == ";" || next == "LIMIT" || next == "COLLATE"))
+									add(columns.order, column_name(tokens[i]) + (next == "DESC" ? " DESC" : ""));
+						}
+		}
+
+		return columns;
+	}
+
+	// unbounded multiple producer, single consumer queue (vyukov's intrusive
+	// mpsc queue). push never blocks or takes a lock, pop is for one thread only
+	template <typename T>
+	class mpsc_queue {
+		struct node {
+			std::atomic<node*> next{ nullptr };
+			T value;
+		};
+
+		std::atomic<node*> head_;
+		node* tail_;
+
+	public:
+		mpsc_queue() {
+			node* stub = new node();
+			head_.store(stub, std::memory_order_relaxed);
+			tail_ = stub;
+		}
+
+		~mpsc_queue() {
+			T value;
+			while (pop(value)) {}
+			delete tail_;
+		}
+
+		mpsc_queue(const mpsc_queue&) = delete;
+		mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+		void push(T value) {
+			node* n = new node();
+			n->value = std::move(value);
+			node* previous = head_.exchange(n, std::memory_order_acq_rel);
+			previous->next.store(n, std::memory_order_release);
+		}
+
+		// only for the consumer, like pop
+		bool empty() const {
+			return !tail_->next.load(std::memory_order_acquire);
+		}
+
+		bool pop(T& value) {
+			node* next = tail_->next.load(std::memory_order_acquire);
+			if (!next)
+				return false;
+
+			value = std::move(next->value);
+			delete tail_;
+			tail_ = next;
+			return true;
+		}
+	};
+
+	// sqlite's heap in size classes, four to every power of two from 32 bytes to
+	// 64 KiB, so a block is at most a quarter bigger than asked for. freed blocks
+	// are kept on a free list per class, up to pool_limit bytes in all, and
+	// handed out again instead of going back to malloc. bigger blocks always
+	// come from malloc
+	class pooled_allocator {
+		// in front of every block, 16 bytes to keep the alignment of malloc
+		struct header {
+			size_t size;
+			size_t size_class;
+		};
+
+		static constexpr size_t no_class = static_cast<size_t>(-1);
+
+		struct free_list {
+			std::mutex lock;
+			void* head = nullptr;
+		};
+
+		std::vector<size_t> sizes_;
+		std::vector<free_list> pools_;
+
+	public:
+		std::atomic<size_t> pool_limit{ 16 * 1024 * 1024 };
+		std::atomic<size_t> pooled_bytes{ 0 };
+
+		static std::vector<size_t> class_sizes() {
+			std::vector<size_t> sizes;
+			for (size_t power = 32; power < 64 * 1024; power *= 2)
+				for (size_t step = 0; step < 4; step++)
+					sizes.push_back(power + step * power / 4);
+			sizes.push_back(64 * 1024);
+			return sizes;
+		}
+
+		pooled_allocator() :
+			sizes_(class_sizes()), pools_(sizes_.size()) {}
+
+		// never destroyed, connections may still free into it while the
+		// process exits
+		static pooled_allocator& instance() {
+			static pooled_allocator* allocator = new pooled_allocator();
+			return *allocator;
+		}
+
+		size_t size_class(size_t size) const {
+			const auto it = std::lower_bound(sizes_.begin(), sizes_.end(), size);
+			return it == sizes_.end() ? no_class : it - sizes_.begin();
+		}
+
+		size_t round_up(size_t size) const {
+			const size_t found = size_class(size);
+			return found == no_class ? (size + 7) & ~size_t(7) : sizes_[found];
+		}
+
+		void* allocate(size_t size) {
+			const size_t found = size_class(size);
+			header* block = nullptr;
+
+			if (found != no_class) {
+				auto& pool = pools_[found];
+				std::lock_guard<std::mutex> lock(pool.lock);
+				if (pool.head) {
+					block = static_cast<header*>(pool.head);
+					pool.head = *reinterpret_cast<void**>(block + 1);
+					pooled_bytes -= sizes_[found];
+				}
+			}
+
+			if (!block) {
+				const size_t usable = found == no_class ? size : sizes_[found];
+				block = static_cast<header*>(std::malloc(sizeof(header) + usable));
+				if (!block)
+					return nullptr;
+				block->size = usable;
+				block->size_class = found;
+			}
+
+			return block + 1;
+		}
+
+		void free(void* memory) {
+			if (!memory)
+				return;
+
+			header* block = static_cast<header*>(memory) - 1;
+			if (block->size_class != no_class && pooled_bytes + block->size <= pool_limit) {
+				auto& pool = pools_[block->size_class];
+				std::lock_guard<std::mutex> lock(pool.lock);
+				*reinterpret_cast<void**>(memory) = pool.head;
+				pool.head = block;
+				pooled_bytes += block->size;
+				return;
+			}
+
+			std::free(block);
+		}
+
+		void* reallocate(void* memory, size_t size) {
+			if (!memory)
+				return allocate(size);
+
+			const size_t old_size = block_size(memory);
+			if (size <= old_size && size_class(size) == size_class(old_size))
+				return memory;
+
+			void* moved = allocate(size);
+			if (moved) {
+				std::memcpy(moved, memory, std::min(size, old_size));
+				free(memory);
+			}
+			return moved;
+		}
+
+		static size_t block_size(void* memory) {
+			return memory ? (static_cast<header*>(memory) - 1)->size : 0;
+		}
+
+		// hands the pooled blocks back to malloc
+		void release() {
+			for (auto& pool : pools_) {
+				std::lock_guard<std::mutex> lock(pool.lock);
+				while (pool.head) {
+					header* block = static_cast<header*>(pool.head);
+					pool.head = *reinterpret_cast<void**>(block + 1);
+					pooled_bytes -= block->size;
+					std::free(block);
+				}
+			}
+		}
+
+		static const sqlite3_mem_methods& methods() {
+			static const sqlite3_mem_methods methods = {
+				[](int size) { return instance().allocate(static_cast<size_t>(size)); },
+				[](void* memory) { instance().free(memory); },
+				[](void* memory, int size) { return instance().reallocate(memory, static_cast<size_t>(size)); },
+				[](void* memory) { return static_cast<int>(block_size(memory)); },
+				[](int size) { return static_cast<int>(instance().round_up(static_cast<size_t>(size))); },
+				[](void*) { return SQLITE_OK; },
+				[](void*) { instance().release(); },
+				nullptr
+			};
+			return methods;
+		}
+	};
+
+	bool pooled_allocator_installed = false;
+	std::mutex memory_config_lock;
+
+	// the read session connection that queries of session_owner run on while a
+	// read session uses this thread
+	thread_local const void* session_owner = nullptr;
+	thread_local sqlite3* session_connection = nullptr;
+
+	// workload traces: the magic, then records. a shape record ('S', id,
+	// statement) comes before the first operation record ('O') that uses it.
+	// an operation is flags (1 success, 2 bound values), shape id, thread,
+	// start and duration in ns from the start of the capture, rows and its
+	// values, each a kind (text, number, hash) and a string. numbers are LEB128
+	// varints, strings a varint length and the bytes
+	const std::string trace_magic = "HLIBTRC1";
+
+	void put_varint(std::string& out, unsigned long long value) {
+		do {
+			unsigned char byte = value & 0x7F;
+			value >>= 7;
+			if (value)
+				byte |= 0x80;
+			out += static_cast<char>(byte);
+		} while (value);
+	}
+
+	void put_string(std::string& out, const std::string& value) {
+		put_varint(out, value.size());
+		out += value;
+	}
+
+	bool get_varint(std::istream& in, unsigned long long& value) {
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			const int byte = in.get();
+			if (byte == EOF)
+				return false;
+
+			value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool get_string(std::istream& in, std::string& value) {
+		unsigned long long size = 0;
+		if (!get_varint(in, size) || size > (1ull << 30))
+			return false;
+
+		value.resize(static_cast<size_t>(size));
+		return size == 0 || static_cast<bool>(in.read(&value[0], static_cast<std::streamsize>(size)));
+	}
+
+	// fnv-1a, for traces that keep hashes of the values only
+	std::string value_hash(const std::string& value) {
+		unsigned long long hash = 14695981039346656037ull;
+		for (const unsigned char c : value) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+
+		static const char digits[] = "0123456789abcdef";
+		std::string hex(16, '0');
+		for (int i = 15; i >= 0; i--, hash >>= 4)
+			hex[i] = digits[hash & 0xF];
+		return hex;
+	}
+
+	// a small number for every thread that runs a query, for traces
+	unsigned thread_number() {
+		static std::atomic<unsigned> next{ 0 };
+		thread_local const unsigned number = next++;
+		return number;
+	}
+}
+
+namespace {
+	class sqlite_category_ : public std::error_category {
+	public:
+		const char* name() const noexcept override {
+			return "sqlite";
+		}
+
+		// formatted only when asked for
+		std::string message(int code) const override {
+			std::string message = sqlite3_errstr(code);
+			if (!message.empty()) message[0] = toupper(message[0]);
+			return message;
+		}
+
+		std::error_condition default_error_condition(int code) const noexcept override {
+			switch (code & 0xFF) {
+			case SQLITE_NOMEM:
+				return std::errc::not_enough_memory;
+			case SQLITE_PERM:
+			case SQLITE_AUTH:
+				return std::errc::permission_denied;
+			case SQLITE_BUSY:
+			case SQLITE_LOCKED:
+				return std::errc::resource_unavailable_try_again;
+			case SQLITE_READONLY:
+				return std::errc::read_only_file_system;
+			case SQLITE_INTERRUPT:
+				return std::errc::interrupted;
+			case SQLITE_IOERR:
+				return std::errc::io_error;
+			case SQLITE_FULL:
+				return std::errc::no_space_on_device;
+			case SQLITE_CANTOPEN:
+				return std::errc::no_such_file_or_directory;
+			case SQLITE_TOOBIG:
+				return std::errc::value_too_large;
+			case SQLITE_MISUSE:
+			case SQLITE_RANGE:
+				return std::errc::invalid_argument;
+			default:
+				return std::error_condition(code, *this);
+			}
+		}
+	};
+
+	class hlib_category_ : public std::error_category {
+	public:
+		const char* name() const noexcept override {
+			return "hlib";
+		}
+
+		std::string message(int code) const override {
+			switch (static_cast<hlib::error_>(code)) {
+			case hlib::error_::not_connected:
+				return "Not connected to database";
+			case hlib::error_::invalid_argument:
+				return "Invalid argument";
+			default:
+				return "Unknown error";
+			}
+		}
+
+		std::error_condition default_error_condition(int code) const noexcept override {
+			if (static_cast<hlib::error_>(code) == hlib::error_::invalid_argument)
+				return std::errc::invalid_argument;
+			return std::error_condition(code, *this);
+		}
+	};
+}
+
+const std::error_category& hlib::sqlite_category() {
+	static const sqlite_category_ category;
+	return category;
+}
+
+const std::error_category& hlib::hlib_category() {
+	static const hlib_category_ category;
+	return category;
+}
+
+std::error_code hlib::make_error_code(error_ code) {
+	return std::error_code(static_cast<int>(code), hlib_category());
+}
+
+class hlib::hbase::hbase_impl {
+	friend hbase;
+
+	bool connected_;
+	sqlite3* db_;
+	file_ database_;
+	std::map<std::string, table_> tables_;
+
+	// pause between backup steps so that writers can get the lock
+	const int backup_step_pause_ = 5;
+
+	// how long a backup waits for a busy source before it gives up
+	const int backup_busy_timeout_ = 30000;
+
+	// blobs are streamed in chunks of this size
+	const size_t blob_chunk_size_ = 64 * 1024;
+
+	// an estimate of the memory taken by the rows of the last query and the
+	// most any query took, for memory_report
+	std::atomic<unsigned long long> result_bytes_{ 0 };
+	std::atomic<unsigned long long> result_bytes_peak_{ 0 };
+
+	struct statement_stats {
+		unsigned long long calls = 0;
+		unsigned long long errors = 0;
+		unsigned long long rows = 0;
+		unsigned long long bytes = 0;
+		long long prepare_time = 0;
+		long long step_time = 0;
+		long long materialize_time = 0;
+		latency_histogram latency;
+	};
+
+	// true when either statistics or the slow query callback are on
+	std::atomic<bool> instrument_{ false };
+	bool stats_enabled_ = false;
+	double slow_query_threshold_ = 0.0;
+	slow_query_callback slow_query_callback_;
+	std::unordered_map<std::string, statement_stats> stats_;
+	std::mutex stats_lock_;
+
+	// the plan of a slow statement shape and the index that would serve it on
+	// each of its tables, if any. guarded by stats_lock_
+	struct plan_record {
+		std::string plan;
+		std::vector<std::string> full_scans;
+		bool temp_b_tree = false;
+		std::vector<std::pair<std::string, std::vector<std::string>>> indexes;
+		unsigned long long calls = 0;
+		double total_ms = 0.0;
+	};
+
+	double plan_threshold_ = -1.0;
+	std::unordered_map<std::string, plan_record> plans_;
+
+	// change feed. pending_changes_ (the changes of the open transaction) and
+	// committing_changes_ (those whose commit has started) are only touched
+	// with the connection mutex held. once the commit is done the batch goes
+	// through the queue to change_thread_, which hands it to the subscribers
+	std::vector<change_> pending_changes_;
+	std::vector<change_> committing_changes_;
+	mpsc_queue<std::vector<change_>> change_batches_;
+	std::map<int, change_callback> subscribers_;
+	int next_subscription_ = 1;
+	std::mutex subscribers_lock_;
+	std::atomic<bool> change_hooks_{ false };
+	std::thread change_thread_;
+	std::atomic<bool> change_thread_stop_{ false };
+	std::mutex change_wait_lock_;
+	std::condition_variable change_wait_;
+
+	// the columns of the primary key of every table, by their place in the
+	// table, for reading keys in the preupdate hook
+	std::map<std::string, std::vector<int>> change_keys_;
+
+	// hot tables live in the connection's temp schema, kept in memory, which
+	// shadows main for names without a schema. the rowids of changed rows are
+	// kept in hlib_dirty_<table> until flush() copies the rows to main
+	std::vector<table_> hot_tables_;
+	std::thread flush_thread_;
+	bool flush_stop_ = false;
+	std::mutex flush_lock_;
+	std::condition_variable flush_wait_;
+
+	// background checkpoints. the wal hook, which replaces sqlite's automatic
+	// checkpoints, counts the commits and remembers the size of the wal
+	checkpoint_policy_ checkpoint_settings_;
+	std::thread checkpoint_thread_;
+	bool checkpoint_stop_ = false;
+	std::mutex checkpoint_lock_;
+	std::condition_variable checkpoint_wait_;
+	std::atomic<long long> wal_frames_{ 0 };
+	std::atomic<unsigned long long> wal_commits_{ 0 };
+	std::atomic<long long> last_commit_{ 0 };
+	checkpoint_stats_ checkpoint_totals_;
+	std::mutex checkpoint_stats_lock_;
+
+	// maintenance. optimize and vacuum run on this connection, since PRAGMA
+	// optimize looks at what the connection's own queries used
+	maintenance_policy_ maintenance_settings_;
+	std::thread maintenance_thread_;
+	bool maintenance_stop_ = false;
+	std::mutex maintenance_lock_;
+	std::condition_variable maintenance_wait_;
+	std::atomic<unsigned long long> optimizes_{ 0 };
+	std::atomic<unsigned long long> vacuums_{ 0 };
+	std::atomic<unsigned long long> pages_vacuumed_{ 0 };
+
+	// workload capture, see start_capture. the file and the shape ids are
+	// guarded by capture_lock_
+	std::atomic<bool> capturing_{ false };
+	std::ofstream capture_file_;
+	bool capture_hash_values_ = false;
+	clock_::time_point capture_start_;
+	std::unordered_map<std::string, unsigned long long> capture_shapes_;
+	std::mutex capture_lock_;
+
+	// idle read only connections, kept for the next read session or scan so
+	// that the key derivation of an encrypted database is not run again. a
+	// scan uses up to one per core
+	std::vector<sqlite3*> read_connections_;
+	std::mutex read_connections_lock_;
+	const size_t idle_read_connections_ = std::max<size_t>(4, std::thread::hardware_concurrency());
+
+	// the functions registered with create_function and create_aggregate,
+	// registered again with every read only connection when it is taken
+	struct function_registration_ {
+		std::string name;
+		int arguments = 0;
+		function_flags_ flags;
+		std::shared_ptr<scalar_function> function;
+		std::shared_ptr<aggregate_callbacks_> callbacks;
+	};
+	std::vector<function_registration_> functions_;
+	std::mutex functions_lock_;
+
+public:
+	hbase_impl() :
+		connected_(false),
+		db_(nullptr) {}
+
+	~hbase_impl() {
+		stop_flush();
+
+		std::string error;
+		flush(error);
+
+		stop_maintenance();
+		stop_checkpoints();
+		stop_changes();
+		stop_capture();
+
+		for (auto db : read_connections_)
+			sqlite3_close(db);
+
+		if (db_) {
+			// close database
+			sqlite3_close(db_);
+			db_ = nullptr;
+		}
+	}
+
+	std::string sqlite_error(int error_code) {
+		std::string error = sqlite3_errstr(error_code);
+		if (error == "not an error") error.clear();
+		if (error.length() > 0) error[0] = toupper(error[0]);
+		return error;
+	}
+
+	// the connection queries run on: db_, or a read session's on its thread
+	sqlite3* connection() const {
+		return session_owner == this ? session_connection : db_;
+	}
+
+	std::string sqlite_error() {
+		if (sqlite3* db = connection()) {
+			std::string error = sqlite3_errmsg(db);
+			if (error == "not an error") error.clear();
+			if (error.length() > 0) error[0] = toupper(error[0]);
+			return error;
+		}
+		else {
+			return "Database not open";
+		}
+	}
+
+	std::string sqlite_error(sqlite3* db) {
+		std::string error = sqlite3_errmsg(db);
+		if (error == "not an error") error.clear();
+		if (error.length() > 0) error[0] = toupper(error[0]);
+		return error;
+	}
+
+	// open (and key, if there is a password or raw key) a database file.
+	// on failure the handle is closed and set to nullptr
+	// read only connections are for one thread, e.g. a scan worker
+	bool open_database(const file_& file,
+		sqlite3*& db,
+		std::string& error,
+		bool read_only = false) {
+		int error_code = sqlite3_open_v2(file.name.c_str(), &db, read_only ?
+			SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX :
+			SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, NULL);
+
+		// lookaside can only be changed before the connection first uses it
+		if (error_code == SQLITE_OK && file.lookaside_slot_size > 0 && file.lookaside_slots > 0)
+			error_code = sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, nullptr,
+				file.lookaside_slot_size, file.lookaside_slots);
+
+		if (error_code == SQLITE_OK && !file.raw_key.empty() &&
+			!((file.raw_key.length() == 64 || file.raw_key.length() == 96) &&
+				file.raw_key.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos)) {
+			sqlite3_close(db);
+			db = nullptr;
+			error = "Raw key must be 64 or 96 hex digits";
+			return false;
+		}
+
+		// a raw key is used as is, a password goes through the kdf
+		const std::string key = file.raw_key.empty() ? file.password : "x'" + file.raw_key + "'";
+
+		if (error_code == SQLITE_OK && !key.empty()) {
+			// key the database
+#ifdef SQLITE_HAS_CODEC
+			error_code = sqlite3_key_v2(db, "main", key.data(), static_cast<int>(key.length()));
+#else
+			std::string escaped;
+			for (const char c : key)
+				escaped += c == '"' ? std::string("\"\"") : std::string(1, c);
+
+			const std::string pragma_string = "PRAGMA key = \"" + escaped + "\";";
+			sqlite3_exec(db, pragma_string.c_str(), NULL, NULL, NULL);
+#endif
+			if (error_code == SQLITE_OK && file.raw_key.empty() && file.kdf_iterations > 0)
+				error_code = sqlite3_exec(db, ("PRAGMA kdf_iter = " + std::to_string(file.kdf_iterations) + ";").c_str(),
+					NULL, NULL, NULL);
+
+			if (error_code == SQLITE_OK && file.cipher_page_size > 0)
+				error_code = sqlite3_exec(db, ("PRAGMA cipher_page_size = " + std::to_string(file.cipher_page_size) + ";").c_str(),
+					NULL, NULL, NULL);
+		}
+
+		// test if key is correct
+		if (error_code == SQLITE_OK)
+			error_code = sqlite3_exec(db, "SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL);
+
+		// a negative cache_size is in KiB
+		if (error_code == SQLITE_OK && file.cache_size_kb > 0)
+			error_code = sqlite3_exec(db, ("PRAGMA cache_size = -" + std::to_string(file.cache_size_kb) + ";").c_str(),
+				NULL, NULL, NULL);
+
+		// used by the statements that maintain row hashes
+		if (error_code == SQLITE_OK)
+			error_code = sqlite3_create_function_v2(db, "hlib_row_hash", -1,
+				SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, &row_hash_function, nullptr, nullptr, nullptr);
+
+		if (error_code != SQLITE_OK) {
+			// an error occured
+			error = sqlite_error(error_code);
+
+			// close database
+			sqlite3_close(db);
+			db = nullptr;
+			return false;
+		}
+
+		return true;
+	}
+
+	// failures are reported as messages or, without formatting anything, as
+	// codes. a message is sqlite's for the connection, which names e.g. the
+	// missing table where the code only says it was an error
+	void set_error(std::string& error, int) {
+		error = sqlite_error();
+	}
+
+	void set_error(std::error_code& error, int code) {
+		error.assign(code, sqlite_category());
+	}
+
+	static void set_error(std::string& error, error_ code) {
+		error = make_error_code(code).message();
+	}
+
+	static void set_error(std::error_code& error, error_ code) {
+		error = code;
+	}
+
+	static void clear_error(std::string&) {}
+
+	static void clear_error(std::error_code& error) {
+		error.clear();
+	}
+
+	// the message of an error code returned by a method on this connection
+	std::string message(const std::error_code& error) {
+		sqlite3* db = connection();
+		if (error.category() == sqlite_category() && db && sqlite3_errcode(db) == error.value())
+			return sqlite_error();
+		return error.message();
+	}
+
+	// calls the std::error_code overload of a method for its std::string one
+	template <typename function>
+	bool with_message(std::string& error, function call) {
+		std::error_code error_code;
+		if (call(error_code))
+			return true;
+
+		error = message(error_code);
+		return false;
+	}
+
+	template <typename error_type>
+	// with append the rows are added to the end of table, e.g. the caller's
+	// records, instead of replacing its contents. binds are bound, as text, to
+	// the parameters of the query in order
+	bool sqlite_query(const std::string& query,
+		table& table,
+		error_type& error,
+		bool append = false,
+		const std::vector<field_>* binds = nullptr) {
+		if (!append)
+			table.clear();
+		const size_t first_row = table.size();
+
+		if (sqlite3* db = connection()) {
+			sqlite3_stmt* statement = nullptr;
+
+			const bool instrument = instrument_.load(std::memory_order_relaxed);
+			stopwatch timer(instrument);
+			long long prepare_time = 0, step_time = 0, materialize_time = 0;
+			unsigned long long bytes = 0;
+			bool success = true;
+
+			if (sqlite3_prepare_v2(db, query.c_str(), -1, &statement, 0) == SQLITE_OK) {
+				if (binds) {
+					int index = 1;
+					for (const auto& bind : *binds)
+						sqlite3_bind_text(statement, index++, bind.value.c_str(),
+							static_cast<int>(bind.value.length()), SQLITE_TRANSIENT);
+				}
+
+				prepare_time = timer.lap();
+				const int columns = sqlite3_column_count(statement);
+
+				// column names are the same for every row
+				std::vector<std::string> column_names;
+				column_names.reserve(columns);
+				for (int column = 0; column < columns; column++) {
+					const char* ccColumn = sqlite3_column_name(statement, column);
+					column_names.push_back(ccColumn ? ccColumn : "");
+				}
+
+				while (true) {
+					const int step = step_statement(db, statement);
+					step_time += timer.lap();
+
+					if (step == SQLITE_ROW) {
+						table.emplace_back();
+						auto& values = table.back();
+
+						for (int column = 0; column < columns; column++) {
+							// get data
+							const char* ccData = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+							const int length = ccData ? sqlite3_column_bytes(statement, column) : 0;
+
+							bytes += length;
+							values.emplace(column_names[column], std::string(ccData ? ccData : "", length));
+						}
+
+						materialize_time += timer.lap();
+					}
+					else {
+						if (step != SQLITE_DONE) {
+							set_error(error, step);
+							success = false;
+						}
+						break;
+					}
+				}
+				sqlite3_finalize(statement);
+
+				if (success)
+					note_result(table.size() - first_row, column_names, bytes);
+			}
+			else {
+				set_error(error, sqlite3_errcode(db));
+
+				if (instrument)
+					record_query(query, false, timer.lap(), 0, 0, 0, 0, binds);
+				return false;
+			}
+
+			if (instrument)
+				record_query(query, success, prepare_time, step_time, materialize_time, table.size() - first_row, bytes,
+					binds);
+
+			// nothing is added by a query that fails
+			if (!success)
+				table.erase(table.begin() + first_row, table.end());
+			return success;
+		}
+		else {
+			set_error(error, error_::not_connected);
+			return false;
+		}
+	}
+
+	// a row is a map node per column, each with the column's name and value
+	void note_result(size_t rows,
+		const std::vector<std::string>& column_names,
+		unsigned long long value_bytes) {
+		using row = table::value_type;
+
+		unsigned long long row_bytes = sizeof(row);
+		for (const auto& name : column_names)
+			row_bytes += sizeof(row::value_type) + 4 * sizeof(void*) + name.size();
+
+		const unsigned long long bytes = rows * row_bytes + value_bytes;
+		result_bytes_.store(bytes, std::memory_order_relaxed);
+
+		unsigned long long peak = result_bytes_peak_.load(std::memory_order_relaxed);
+		while (bytes > peak && !result_bytes_peak_.compare_exchange_weak(peak, bytes, std::memory_order_relaxed));
+	}
+
+	// with stats_lock_ held
+	void update_instrument() {
+		instrument_ = stats_enabled_ || slow_query_callback_ || plan_threshold_ >= 0 || capturing_;
+	}
+
+	// binds are the values bound to the statement's parameters, if any
+	void record_query(const std::string& query,
+		bool success,
+		long long prepare_time,
+		long long step_time,
+		long long materialize_time,
+		unsigned long long rows,
+		unsigned long long bytes,
+		const std::vector<field_>* binds = nullptr) {
+		const long long total_time = prepare_time + step_time + materialize_time;
+		const double total_ms = total_time / 1e6;
+
+		slow_query_callback callback;
+		bool capture = false;
+		{
+			std::lock_guard<std::mutex> lock(stats_lock_);
+
+			if (stats_enabled_) {
+				auto& stats = stats_[normalize_statement(query)];
+				stats.calls++;
+				if (!success) stats.errors++;
+				stats.rows += rows;
+				stats.bytes += bytes;
+				stats.prepare_time += prepare_time;
+				stats.step_time += step_time;
+				stats.materialize_time += materialize_time;
+				stats.latency.add(total_time);
+			}
+
+			if (slow_query_callback_ && total_ms >= slow_query_threshold_)
+				callback = slow_query_callback_;
+
+			capture = success && plan_threshold_ >= 0 && total_ms >= plan_threshold_;
+		}
+
+		if (capture)
+			capture_plan(query, total_ms);
+
+		if (capturing_.load(std::memory_order_relaxed))
+			capture_operation(query, binds, success, total_time, rows);
+
+		// called outside the lock so that the callback may use this object
+		if (callback)
+			callback(query, total_ms);
+	}
+
+	bool start_capture(const std::string& path,
+		bool hash_values,
+		std::string& error) {
+		{
+			std::lock_guard<std::mutex> lock(capture_lock_);
+			if (capture_file_.is_open()) {
+				error = "A capture is already running";
+				return false;
+			}
+
+			capture_file_.open(path, std::ios::binary | std::ios::trunc);
+			if (!capture_file_) {
+				capture_file_.close();
+				error = "Cannot open " + path;
+				return false;
+			}
+
+			capture_file_ << trace_magic;
+			capture_shapes_.clear();
+			capture_hash_values_ = hash_values;
+			capture_start_ = clock_::now();
+			capturing_ = true;
+		}
+
+		std::lock_guard<std::mutex> lock(stats_lock_);
+		update_instrument();
+		return true;
+	}
+
+	void stop_capture() {
+		{
+			std::lock_guard<std::mutex> lock(capture_lock_);
+			if (!capture_file_.is_open())
+				return;
+
+			capturing_ = false;
+			capture_file_.close();
+		}
+
+		std::lock_guard<std::mutex> lock(stats_lock_);
+		update_instrument();
+	}
+
+	// the record is encoded before the lock is taken
+	void capture_operation(const std::string& query,
+		const std::vector<field_>* binds,
+		bool success,
+		long long duration,
+		unsigned long long rows) {
+		const auto end = clock_::now();
+
+		std::vector<std::pair<bool, std::string>> values;
+		std::string shape;
+		if (binds) {
+			shape = query;
+			for (const auto& bind : *binds)
+				values.emplace_back(true, bind.value);
+		}
+		else
+			shape = normalize_statement(query, &values);
+
+		std::string operation;
+		operation += 'O';
+		operation += static_cast<char>((success ? 1 : 0) | (binds ? 2 : 0));
+
+		std::string tail;
+		put_varint(tail, thread_number());
+
+		std::lock_guard<std::mutex> lock(capture_lock_);
+		if (!capture_file_.is_open())
+			return;
+
+		const long long start = std::max(0ll, static_cast<long long>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(end - capture_start_).count()) - duration);
+		put_varint(tail, static_cast<unsigned long long>(start));
+		put_varint(tail, static_cast<unsigned long long>(std::max(0ll, duration)));
+		put_varint(tail, rows);
+		put_varint(tail, values.size());
+
+		for (const auto& value : values) {
+			tail += static_cast<char>(capture_hash_values_ ? 2 : (value.first ? 0 : 1));
+			put_string(tail, capture_hash_values_ ? value_hash(value.second) : value.second);
+		}
+
+		auto it = capture_shapes_.find(shape);
+		if (it == capture_shapes_.end()) {
+			it = capture_shapes_.emplace(shape, capture_shapes_.size()).first;
+
+			std::string definition(1, 'S');
+			put_varint(definition, it->second);
+			put_string(definition, shape);
+			capture_file_ << definition;
+		}
+
+		put_varint(operation, it->second);
+		capture_file_ << operation << tail;
+	}
+
+	// explains a statement the first time its shape is slow, later slow calls
+	// only add to its counts
+	void capture_plan(const std::string& query,
+		double milliseconds) {
+		const std::string shape = normalize_statement(query);
+		{
+			std::lock_guard<std::mutex> lock(stats_lock_);
+			auto it = plans_.find(shape);
+			if (it != plans_.end()) {
+				it->second.calls++;
+				it->second.total_ms += milliseconds;
+				return;
+			}
+		}
+
+		plan_record record;
+		if (!explain(query, record))
+			return;
+
+		std::lock_guard<std::mutex> lock(stats_lock_);
+		auto& captured = plans_.emplace(shape, std::move(record)).first->second;
+		captured.calls++;
+		captured.total_ms += milliseconds;
+	}
+
+	// runs EXPLAIN QUERY PLAN directly on the connection, so it is not counted
+	// as a query itself
+	bool explain(const std::string& query,
+		plan_record& record) {
+		sqlite3_stmt* statement = nullptr;
+		if (sqlite3_prepare_v2(db_, ("EXPLAIN QUERY PLAN " + query).c_str(), -1, &statement, 0) != SQLITE_OK) {
+			sqlite3_finalize(statement);
+			return false;
+		}
+
+		// the tables the plan reads, in order
+		std::vector<std::string> plan_tables;
+		std::map<int, int> depth;
+
+		while (sqlite3_step(statement) == SQLITE_ROW) {
+			const int id = sqlite3_column_int(statement, 0);
+			const int parent = sqlite3_column_int(statement, 1);
+			const char* text = reinterpret_cast<const char*>(sqlite3_column_text(statement, 3));
+			const std::string detail(text ? text : "");
+
+			depth[id] = depth.count(parent) ? depth[parent] + 1 : 0;
+			record.plan += std::string(depth[id] * 2, ' ') + detail + "\n";
+
+			// SCAN t, SCAN t USING INDEX i, SEARCH t USING INDEX i (a = ?), and
+			// SCAN TABLE t before sqlite 3.36
+			std::istringstream words(detail);
+			std::string operation, name;
+			words >> operation >> name;
+			if (name == "TABLE")
+				words >> name;
+
+			if ((operation == "SCAN" || operation == "SEARCH") && tables_.count(name)) {
+				if (std::find(plan_tables.begin(), plan_tables.end(), name) == plan_tables.end())
+					plan_tables.push_back(name);
+
+				if (operation == "SCAN" && detail.find(" USING ") == std::string::npos)
+					record.full_scans.push_back(name);
+			}
+
+			if (detail.find("USE TEMP B-TREE FOR") != std::string::npos &&
+				(detail.find("ORDER BY") != std::string::npos || detail.find("GROUP BY") != std::string::npos))
+				record.temp_b_tree = true;
+		}
+		sqlite3_finalize(statement);
+
+		const statement_columns columns = parse_statement_columns(query);
+
+		for (const auto& name : plan_tables) {
+			const auto& table_ = tables_.at(name);
+
+			// the table's own spelling of a column, or an empty string
+			auto find_column = [&table_](std::string column) {
+				std::string direction;
+				const size_t space = column.find(' ');
+				if (space != std::string::npos) {
+					direction = column.substr(space);
+					column.erase(space);
+				}
+
+				for (const auto& col : table_.columns)
+					if (to_upper(col.name) == to_upper(column))
+						return col.name + direction;
+				return std::string();
+			};
+
+			std::vector<std::string> index;
+			for (const auto& column : columns.equality) {
+				const std::string found = find_column(column);
+				if (!found.empty())
+					index.push_back(found);
+			}
+
+			const bool full_scan = std::find(record.full_scans.begin(), record.full_scans.end(), name) != record.full_scans.end();
+
+			// a sort is only saved when the index has every column of the ORDER BY
+			std::vector<std::string> order;
+			for (const auto& column : columns.order) {
+				const std::string found = find_column(column);
+				if (found.empty()) {
+					order.clear();
+					break;
+				}
+				if (std::find(index.begin(), index.end(), found) == index.end())
+					order.push_back(found);
+			}
+
+			bool helps = false;
+			if (record.temp_b_tree && plan_tables.size() == 1 && !order.empty()) {
+				index.insert(index.end(), order.begin(), order.end());
+				helps = true;
+			}
+			else
+				if (full_scan) {
+					for (const auto& column : columns.range) {
+						const std::string found = find_column(column);
+						if (!found.empty()) {
+							index.push_back(found);
+							break;
+						}
+					}
+					helps = !index.empty();
+				}
+
+			if (helps)
+				record.indexes.emplace_back(name, index);
+		}
+
+		return true;
+	}
+
+	// the hlib_row_hash call for a row of table_, values holds the sql
+	// expression of every column, in order
+	static std::string row_hash_call(const table_& table_,
+		const std::vector<std::string>& values) {
+		std::string types, call;
+		for (size_t i = 0; i < table_.columns.size(); i++) {
+			switch (table_.columns[i].type) {
+			case column_type_::integer_:
+				types += 'i';
+				break;
+			case column_type_::float_:
+				types += 'r';
+				break;
+			case column_type_::blob_:
+				types += 'b';
+				break;
+			case column_type_::text_:
+			default:
+				types += 't';
+				break;
+			}
+
+			call += "," + values[i];
+		}
+
+		return "hlib_row_hash('" + types + "'" + call + ")";
+	}
+
+	// of the row as it is stored
+	static std::string row_hash_call(const table_& table_) {
+		std::vector<std::string> columns;
+		for (const auto& col : table_.columns)
+			columns.push_back(col.name);
+		return row_hash_call(table_, columns);
+	}
+
+	// the row hash of a table that is being written, with the literal of every
+	// column the write sets (others keep their value, or are NULL when
+	// inserted). an empty string if the table has no row hashes
+	std::string row_hash_expression(const std::string& table_name,
+		const std::vector<field_>& fields,
+		bool insert) {
+		auto it = tables_.find(table_name);
+		if (it == tables_.end() || !it->second.row_hash)
+			return "";
+
+		std::vector<std::string> values;
+		for (const auto& col : it->second.columns) {
+			auto field = std::find_if(fields.begin(), fields.end(), [&](const field_& field) {
+				return to_upper(field.name) == to_upper(col.name);
+				});
+
+			if (field != fields.end())
+				values.push_back("'" + field->value + "'");
+			else
+				values.push_back(insert ? "NULL" : col.name);
+		}
+
+		return row_hash_call(it->second, values);
+	}
+
+	// add the row hash column to a table (if it is not there yet) and hash the
+	// rows that have no hash. hashes are written by the statements that change
+	// rows, not by triggers, as the file must stay usable by connections
+	// without hlib_row_hash
+	bool create_row_hash(const table_& table_, std::string& error) {
+		table result;
+
+		if (!sqlite_query("SELECT name FROM pragma_table_info('" + table_.name + "') WHERE name = '" +
+			row_hash_column + "';", result, error))
+			return false;
+
+		if (result.empty() &&
+			!sqlite_query("ALTER TABLE " + table_.name + " ADD COLUMN " + row_hash_column + " TEXT NULL;", result, error))
+			return false;
+
+		// files written by earlier versions have triggers that need the function
+		if (!sqlite_query("DROP TRIGGER IF EXISTS hlib_row_hash_insert_" + table_.name + ";", result, error) ||
+			!sqlite_query("DROP TRIGGER IF EXISTS hlib_row_hash_update_" + table_.name + ";", result, error))
+			return false;
+
+		return sqlite_query("UPDATE " + table_.name + " SET " + row_hash_column + " = " + row_hash_call(table_) +
+			" WHERE " + row_hash_column + " IS NULL;", result, error);
+	}
+
+	// the full text index of a table and its triggers, if there are any
+	bool drop_full_text(const std::string& table_name, std::string& error) {
+		table result;
+		return sqlite_query("DROP TRIGGER IF EXISTS hlib_fts_insert_" + table_name + ";", result, error) &&
+			sqlite_query("DROP TRIGGER IF EXISTS hlib_fts_delete_" + table_name + ";", result, error) &&
+			sqlite_query("DROP TRIGGER IF EXISTS hlib_fts_update_" + table_name + ";", result, error) &&
+			sqlite_query("DROP TABLE IF EXISTS hlib_fts_" + table_name + ";", result, error);
+	}
+
+	// an external content fts5 index over the searchable columns of a table,
+	// kept in sync with the table by triggers
+	bool create_full_text(const table_& table_, std::string& error) {
+		table result;
+
+		std::string columns, new_columns, old_columns;
+		for (const auto& col : table_.columns)
+			if (col.searchable) {
+				const std::string separator = columns.empty() ? "" : ",";
+				columns += separator + col.name;
+				new_columns += separator + "new." + col.name;
+				old_columns += separator + "old." + col.name;
+			}
+
+		const std::string fts = "hlib_fts_" + table_.name;
+
+		if (!sqlite_query("SELECT name FROM pragma_table_info('" + fts + "');", result, error))
+			return false;
+		bool exists = !result.empty();
+
+		// the searchable columns changed since the index was made, it is built again
+		std::string indexed;
+		for (auto& row : result)
+			indexed += (indexed.empty() ? "" : ",") + row["name"];
+
+		if (exists && to_upper(indexed) != to_upper(columns)) {
+			if (!drop_full_text(table_.name, error))
+				return false;
+			exists = false;
+		}
+
+		if (!exists &&
+			!sqlite_query("CREATE VIRTUAL TABLE " + fts + " USING fts5(" + columns + ", content='" + table_.name +
+				"', content_rowid='rowid');", result, error))
+			return false;
+
+		const std::string insert = "INSERT INTO " + fts + "(rowid," + columns + ") VALUES (new.rowid," + new_columns + ");";
+		const std::string remove = "INSERT INTO " + fts + "(" + fts + ",rowid," + columns + ") VALUES ('delete',old.rowid," +
+			old_columns + ");";
+
+		if (!sqlite_query("CREATE TRIGGER IF NOT EXISTS hlib_fts_insert_" + table_.name + " AFTER INSERT ON " +
+			table_.name + " BEGIN " + insert + " END;", result, error))
+			return false;
+
+		if (!sqlite_query("CREATE TRIGGER IF NOT EXISTS hlib_fts_delete_" + table_.name + " AFTER DELETE ON " +
+			table_.name + " BEGIN " + remove + " END;", result, error))
+			return false;
+
+		if (!sqlite_query("CREATE TRIGGER IF NOT EXISTS hlib_fts_update_" + table_.name + " AFTER UPDATE OF " + columns +
+			" ON " + table_.name + " BEGIN " + remove + insert + " END;", result, error))
+			return false;
+
+		// index the rows that were there before the index
+		if (!exists &&
+			!sqlite_query("INSERT INTO " + fts + "(" + fts + ") VALUES ('rebuild');", result, error))
+			return false;
+
+		return true;
+	}
+
+	// (primary key, row hash) for every row of a table
+	bool get_row_hashes(const std::string& table_name,
+		row_hashes& hashes,
+		std::string& error) {
+		hashes.clear();
+
+		auto it = tables_.find(table_name);
+		if (it == tables_.end() || !it->second.row_hash) {
+			error = "Table " + table_name + " has no row hashes";
+			return false;
+		}
+
+		// rows written without hlib have no hash yet
+		const auto& keys = it->second.primary_key;
+		std::string sql = "SELECT ";
+		for (const auto& key : keys)
+			sql += key + ",";
+		sql += "coalesce(" + row_hash_column + "," + row_hash_call(it->second) + ") FROM " + table_name + ";";
+
+		sqlite3_stmt* statement = nullptr;
+		if (sqlite3_prepare_v2(connection(), sql.c_str(), -1, &statement, 0) != SQLITE_OK) {
+			error = sqlite_error();
+			return false;
+		}
+
+		const int columns = static_cast<int>(keys.size());
+		int step;
+		while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+			std::vector<std::string> key;
+			key.reserve(keys.size());
+			for (int column = 0; column < columns; column++) {
+				const char* value = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+				key.push_back(value ? value : "");
+			}
+
+			const char* hash = reinterpret_cast<const char*>(sqlite3_column_text(statement, columns));
+			hashes.emplace(std::move(key), hash ? hash : "");
+		}
+
+		// a partial set of hashes would show rows as removed
+		if (step != SQLITE_DONE) {
+			error = sqlite_error();
+			sqlite3_finalize(statement);
+			hashes.clear();
+			return false;
+		}
+
+		sqlite3_finalize(statement);
+		return true;
+	}
+
+	// runs an aggregate query and reads the results as numbers, filter values
+	// are bound rather than spliced into the statement
+	template <typename error_type>
+	bool aggregate(const std::string& sql,
+		const std::vector<field_>& filters,
+		size_t group_columns,
+		size_t value_columns,
+		std::vector<aggregate_row_>& result,
+		error_type& error) {
+		result.clear();
+
+		sqlite3* db = connection();
+		if (!db) {
+			set_error(error, error_::not_connected);
+			return false;
+		}
+
+		const bool instrument = instrument_.load(std::memory_order_relaxed);
+		stopwatch timer(instrument);
+		long long prepare_time = 0, step_time = 0, materialize_time = 0;
+
+		sqlite3_stmt* statement = nullptr;
+		if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, 0) != SQLITE_OK) {
+			set_error(error, sqlite3_errcode(db));
+
+			if (instrument)
+				record_query(sql, false, timer.lap(), 0, 0, 0, 0, &filters);
+			return false;
+		}
+		prepare_time = timer.lap();
+
+		int index = 1;
+		for (const auto& filter : filters)
+			sqlite3_bind_text(statement, index++, filter.value.c_str(),
+				static_cast<int>(filter.value.length()), SQLITE_TRANSIENT);
+
+		int step;
+		while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+			step_time += timer.lap();
+
+			aggregate_row_ row;
+			row.group.reserve(group_columns);
+			row.values.reserve(value_columns);
+
+			int column = 0;
+			for (size_t i = 0; i < group_columns; i++, column++) {
+				const char* value = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+				row.group.push_back(value ? value : "");
+			}
+
+			for (size_t i = 0; i < value_columns; i++, column++) {
+				aggregate_value_ value;
+				if (sqlite3_column_type(statement, column) != SQLITE_NULL) {
+					value.null = false;
+					value.integer = sqlite3_column_int64(statement, column);
+					value.real = sqlite3_column_double(statement, column);
+				}
+				row.values.push_back(value);
+			}
+
+			result.push_back(std::move(row));
+			materialize_time += timer.lap();
+		}
+		step_time += timer.lap();
+
+		const bool success = step == SQLITE_DONE;
+		if (!success)
+			set_error(error, step);
+
+		sqlite3_finalize(statement);
+
+		if (instrument)
+			record_query(sql, success, prepare_time, step_time, materialize_time, result.size(), 0, &filters);
+		return success;
+	}
+
+	// only the tables hlib created, not fts or other internal tables. hot
+	// tables change in temp, their writes to main are flushes
+	bool change_tracked(const char* database_name, const char* table_name) {
+		auto it = tables_.find(table_name);
+		return it != tables_.end() && (!it->second.hot || std::strcmp(database_name, "temp") == 0);
+	}
+
+	void add_change(change_operation_ operation,
+		const char* table_name,
+		long long rowid,
+		std::vector<std::string> key) {
+		// an update of a row that was just inserted or updated, e.g. to refresh
+		// its row hash, adds nothing to the batch
+		if (operation == change_operation_::update_ && !pending_changes_.empty()) {
+			const auto& last = pending_changes_.back();
+			if (last.rowid == rowid && last.operation != change_operation_::delete_ && last.table_name == table_name)
+				return;
+		}
+
+		change_ change;
+		change.operation = operation;
+		change.table_name = table_name;
+		change.rowid = rowid;
+		change.key = std::move(key);
+		pending_changes_.push_back(std::move(change));
+	}
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+	// called before a row changes, while its old values can still be read
+	static void preupdate_hook(void* data,
+		sqlite3* db,
+		int operation,
+		const char* database_name,
+		const char* table_name,
+		sqlite3_int64 old_rowid,
+		sqlite3_int64 new_rowid) {
+		auto& d = *static_cast<hbase_impl*>(data);
+		if (!d.change_tracked(database_name, table_name))
+			return;
+
+		auto read_key = [&](bool old) {
+			std::vector<std::string> key;
+			for (const int column : d.change_keys_[table_name]) {
+				sqlite3_value* value = nullptr;
+				if (old)
+					sqlite3_preupdate_old(db, column, &value);
+				else
+					sqlite3_preupdate_new(db, column, &value);
+
+				const char* text = value ? reinterpret_cast<const char*>(sqlite3_value_text(value)) : nullptr;
+				key.push_back(text ? text : "");
+			}
+			return key;
+		};
+
+#if SQLITE_VERSION_NUMBER >= 3036000
+		// since sqlite 3.36 a write through a blob handle comes as a delete of
+		// the row, for each chunk. it is an update, and those that follow it
+		// add nothing
+		if (sqlite3_preupdate_blobwrite(db) >= 0) {
+			d.add_change(change_operation_::update_, table_name, old_rowid, read_key(true));
+			return;
+		}
+#endif
+
+		switch (operation) {
+		case SQLITE_INSERT:
+			d.add_change(change_operation_::insert_, table_name, new_rowid, read_key(false));
+			break;
+		case SQLITE_DELETE:
+			d.add_change(change_operation_::delete_, table_name, old_rowid, read_key(true));
+			break;
+		case SQLITE_UPDATE:
+		default: {
+			// a row whose key changes is a different row to subscribers
+			auto old_key = read_key(true);
+			auto new_key = read_key(false);
+			if (old_key == new_key)
+				d.add_change(change_operation_::update_, table_name, new_rowid, std::move(new_key));
+			else {
+				d.add_change(change_operation_::delete_, table_name, old_rowid, std::move(old_key));
+				d.add_change(change_operation_::insert_, table_name, new_rowid, std::move(new_key));
+			}
+			break;
+		}
+		}
+	}
+#else
+	// without the preupdate hook the keys are not known
+	static void update_hook(void* data, int operation, const char* database_name, const char* table_name, sqlite3_int64 rowid) {
+		auto& d = *static_cast<hbase_impl*>(data);
+		if (!d.change_tracked(database_name, table_name))
+			return;
+
+		change_operation_ change_operation;
+		switch (operation) {
+		case SQLITE_INSERT:
+			change_operation = change_operation_::insert_;
+			break;
+		case SQLITE_DELETE:
+			change_operation = change_operation_::delete_;
+			break;
+		case SQLITE_UPDATE:
+		default:
+			change_operation = change_operation_::update_;
+			break;
+		}
+
+		d.add_change(change_operation, table_name, rowid, {});
+	}
+#endif
+
+	// called when the transaction starts to commit, which may still fail. the
+	// changes are published by step_statement once the commit is done
+	static int commit_hook(void* data) {
+		auto& d = *static_cast<hbase_impl*>(data);
+
+		// a commit that failed with busy left them there, and is being retried
+		d.committing_changes_.insert(d.committing_changes_.end(),
+			std::make_move_iterator(d.pending_changes_.begin()), std::make_move_iterator(d.pending_changes_.end()));
+		d.pending_changes_.clear();
+		return 0;
+	}
+
+	static void rollback_hook(void* data) {
+		auto& d = *static_cast<hbase_impl*>(data);
+		d.pending_changes_.clear();
+		d.committing_changes_.clear();
+	}
+
+	// steps a statement. with the change feed on, statements of db_ step with
+	// the connection mutex held, so that a finished statement can tell whether
+	// it committed before another one starts
+	int step_statement(sqlite3* db, sqlite3_stmt* statement) {
+		if (db != db_ || !change_hooks_.load(std::memory_order_relaxed))
+			return sqlite3_step(statement);
+
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db);
+		sqlite3_mutex_enter(mutex);
+
+		const size_t pending = pending_changes_.size();
+		const size_t committing = committing_changes_.size();
+		const int step = sqlite3_step(statement);
+
+		// a statement that fails undoes its own changes, which are at the end of
+		// committing_changes_ if a commit took them in the same step
+		if (step != SQLITE_ROW && step != SQLITE_DONE) {
+			if (committing_changes_.size() > committing)
+				committing_changes_.resize(committing + pending);
+			else
+				if (pending_changes_.size() > pending)
+					pending_changes_.resize(pending);
+		}
+
+		// back in autocommit mode after a commit started: it is done. a commit
+		// that failed with busy keeps the transaction open
+		if (step != SQLITE_ROW && !committing_changes_.empty() && sqlite3_get_autocommit(db)) {
+			change_batches_.push(std::move(committing_changes_));
+			committing_changes_.clear();
+
+			// taking the lock orders the push before the delivery thread's check
+			{ std::lock_guard<std::mutex> lock(change_wait_lock_); }
+			change_wait_.notify_one();
+		}
+
+		sqlite3_mutex_leave(mutex);
+		return step;
+	}
+
+	// installs or removes the hooks; call with subscribers_lock_ held
+	void set_change_hooks(bool install) {
+		sqlite3_mutex_enter(sqlite3_db_mutex(db_));
+
+		void* data = install ? this : nullptr;
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+		if (install && change_keys_.empty())
+			for (const auto& it : tables_) {
+				table columns;
+				std::string error;
+				sqlite_query("PRAGMA " + schema_of(it.first) + ".table_info(" + it.first + ");", columns, error);
+
+				auto& key = change_keys_[it.first];
+				for (const auto& name : it.second.primary_key)
+					for (auto& column : columns)
+						if (to_upper(column["name"]) == to_upper(name))
+							key.push_back(std::stoi(column["cid"]));
+			}
+
+		sqlite3_preupdate_hook(db_, install ? preupdate_hook : nullptr, data);
+#else
+		sqlite3_update_hook(db_, install ? update_hook : nullptr, data);
+#endif
+		sqlite3_commit_hook(db_, install ? commit_hook : nullptr, data);
+		sqlite3_rollback_hook(db_, install ? rollback_hook : nullptr, data);
+		pending_changes_.clear();
+		committing_changes_.clear();
+		change_hooks_ = install;
+
+		sqlite3_mutex_leave(sqlite3_db_mutex(db_));
+
+		if (install && !change_thread_.joinable())
+			change_thread_ = std::thread(&hbase_impl::deliver_changes, this);
+	}
+
+	// sleeps until there is a batch, so it is idle while nobody subscribes
+	void deliver_changes() {
+		std::vector<change_> batch;
+		std::vector<change_callback> subscribers;
+
+		while (true) {
+			while (change_batches_.pop(batch)) {
+				{
+					std::lock_guard<std::mutex> lock(subscribers_lock_);
+					subscribers.clear();
+					for (const auto& it : subscribers_)
+						subscribers.push_back(it.second);
+				}
+
+				// called without the lock so that callbacks can unsubscribe
+				for (const auto& callback : subscribers)
+					callback(batch);
+			}
+
+			std::unique_lock<std::mutex> lock(change_wait_lock_);
+			change_wait_.wait(lock, [&]() { return change_thread_stop_.load() || !change_batches_.empty(); });
+
+			// the hooks are gone by the time stop is set, so the queue is drained
+			if (change_thread_stop_.load() && change_batches_.empty())
+				break;
+		}
+	}
+
+	void stop_changes() {
+		if (!change_thread_.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(subscribers_lock_);
+			set_change_hooks(false);
+			subscribers_.clear();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(change_wait_lock_);
+			change_thread_stop_.store(true);
+		}
+		change_wait_.notify_one();
+		change_thread_.join();
+	}
+
+	// reads the rows with rowids in [first, last] through a statement taking
+	// them as its two parameters
+	static bool read_range(sqlite3_stmt* statement,
+		const std::vector<std::string>& columns,
+		long long first,
+		long long last,
+		table& rows) {
+		sqlite3_reset(statement);
+		sqlite3_bind_int64(statement, 1, first);
+		sqlite3_bind_int64(statement, 2, last);
+
+		int step;
+		while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+			std::map<std::string, std::string> values;
+			for (int column = 0; column < static_cast<int>(columns.size()); column++) {
+				const char* value = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+				values.emplace_hint(values.end(), columns[column], value ? value : "");
+			}
+			rows.push_back(std::move(values));
+		}
+
+		return step == SQLITE_DONE;
+	}
+
+	bool parallel_scan(const std::string& table_name,
+		const scan_options_& options,
+		const scan_callback& callback,
+		std::string& error) {
+		table result;
+		if (!sqlite_query("SELECT MIN(rowid) AS first_rowid, MAX(rowid) AS last_rowid, COUNT(*) AS row_count FROM " + table_name + ";",
+			result, error))
+			return false;
+
+		const long long rows = std::atoll(result[0]["row_count"].c_str());
+		if (rows == 0)
+			return true;
+
+		// rowids are usually dense, so equal rowid ranges hold about equally many
+		// rows. the last range is extended to the end of the table
+		const long long first = std::atoll(result[0]["first_rowid"].c_str());
+		const long long last = std::atoll(result[0]["last_rowid"].c_str());
+		const size_t chunk_rows = options.chunk_rows > 0 ? options.chunk_rows : 10000;
+		const long long width = std::max<long long>(1,
+			static_cast<long long>(static_cast<double>(last - first + 1) * chunk_rows / rows));
+
+		std::vector<std::pair<long long, long long>> ranges;
+		for (long long start = first; start <= last; start += width) {
+			ranges.emplace_back(start, start + width - 1);
+			if (start > last - width)
+				break;
+		}
+		ranges.back().second = last;
+
+		// other connections cannot see an in-memory database or hot table, they
+		// are scanned on this connection and thread
+		const char* filename = sqlite3_db_filename(db_, "main");
+		const auto it = tables_.find(table_name);
+		const bool shared = filename && *filename && (it == tables_.end() || !it->second.hot);
+
+		size_t threads = options.threads > 0 ? options.threads : std::thread::hardware_concurrency();
+		threads = std::max<size_t>(1, std::min(threads, ranges.size()));
+		if (!shared)
+			threads = 1;
+
+		// workers stay within window ranges of the next one to be delivered, so
+		// ordered delivery holds a bounded number of chunks back
+		const size_t window = threads * 2;
+
+		std::mutex lock;
+		std::condition_variable delivered_chunk;
+		size_t next_range = 0;
+		size_t next_delivery = 0;
+		std::map<size_t, table> finished;
+		bool stop = false;
+		std::string first_error;
+
+		auto fail = [&](const std::string& message) {
+			std::lock_guard<std::mutex> guard(lock);
+			if (!stop) {
+				stop = true;
+				first_error = message;
+			}
+			delivered_chunk.notify_all();
+		};
+
+		auto worker = [&]() {
+			sqlite3* db = db_;
+			std::string worker_error;
+			if (shared && !take_read_connection(db, worker_error)) {
+				fail(worker_error);
+				return;
+			}
+
+			sqlite3_stmt* statement = nullptr;
+			if (sqlite3_prepare_v2(db, ("SELECT * FROM " + table_name + " WHERE rowid BETWEEN ? AND ? ORDER BY rowid;").c_str(),
+				-1, &statement, 0) != SQLITE_OK) {
+				fail(sqlite_error(db));
+				if (db != db_)
+					return_read_connection(db);
+				return;
+			}
+
+			std::vector<std::string> columns;
+			for (int column = 0; column < sqlite3_column_count(statement); column++)
+				columns.push_back(sqlite3_column_name(statement, column));
+
+			while (true) {
+				size_t range;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					if (options.ordered)
+						delivered_chunk.wait(guard, [&]() { return stop || next_range < next_delivery + window; });
+
+					if (stop || next_range == ranges.size())
+						break;
+					range = next_range++;
+				}
+
+				table chunk;
+				if (!read_range(statement, columns, ranges[range].first, ranges[range].second, chunk)) {
+					fail(sqlite_error(db));
+					break;
+				}
+
+				std::unique_lock<std::mutex> guard(lock);
+				if (stop)
+					break;
+
+				// the callback is called under the lock, one chunk at a time
+				if (!options.ordered) {
+					if (!chunk.empty() && !callback(range, chunk))
+						stop = true;
+					continue;
+				}
+
+				finished.emplace(range, std::move(chunk));
+				for (auto it = finished.begin(); it != finished.end() && it->first == next_delivery;
+					it = finished.erase(it), next_delivery++)
+					if (!it->second.empty() && !callback(it->first, it->second)) {
+						stop = true;
+						break;
+					}
+				delivered_chunk.notify_all();
+			}
+
+			sqlite3_finalize(statement);
+			if (db != db_)
+				return_read_connection(db);
+		};
+
+		std::vector<std::thread> workers;
+		for (size_t i = 1; i < threads; i++)
+			workers.emplace_back(worker);
+		worker();
+
+		for (auto& thread : workers)
+			thread.join();
+
+		if (!first_error.empty()) {
+			error = first_error;
+			return false;
+		}
+		return true;
+	}
+
+	// creates the in-memory copy of a table and loads the rows from main
+	bool create_hot_table(const table_& table_,
+		const std::string& definition,
+		std::string& error) {
+		table result;
+
+		std::string columns;
+		for (const auto& col : table_.columns)
+			columns += (columns.empty() ? "" : ",") + col.name;
+
+		const std::string dirty = "hlib_dirty_" + table_.name;
+
+		if (!sqlite_query("PRAGMA temp_store = MEMORY;", result, error) ||
+			!sqlite_query("CREATE TEMP TABLE " + definition, result, error) ||
+			!sqlite_query("INSERT INTO temp." + table_.name + "(rowid," + columns + ") SELECT rowid," + columns +
+				" FROM main." + table_.name + ";", result, error) ||
+			!sqlite_query("CREATE TEMP TABLE " + dirty + "(id INTEGER PRIMARY KEY);", result, error))
+			return false;
+
+		const std::string mark = "INSERT OR IGNORE INTO " + dirty + " VALUES ";
+		if (!sqlite_query("CREATE TEMP TRIGGER hlib_dirty_insert_" + table_.name + " AFTER INSERT ON " + table_.name +
+			" BEGIN " + mark + "(new.rowid); END;", result, error) ||
+			!sqlite_query("CREATE TEMP TRIGGER hlib_dirty_update_" + table_.name + " AFTER UPDATE ON " + table_.name +
+				" BEGIN " + mark + "(old.rowid),(new.rowid); END;", result, error) ||
+			!sqlite_query("CREATE TEMP TRIGGER hlib_dirty_delete_" + table_.name + " AFTER DELETE ON " + table_.name +
+				" BEGIN " + mark + "(old.rowid); END;", result, error))
+			return false;
+
+		hot_tables_.push_back(table_);
+		return true;
+	}
+
+	// copies the changed rows of the hot tables to main in one transaction.
+	// the connection is held for the whole flush so that no other statement
+	// ends up in its transaction, and a transaction that is already open is
+	// left alone until the next flush
+	bool flush(std::string& error) {
+		if (hot_tables_.empty() || !db_)
+			return true;
+
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+		sqlite3_mutex_enter(mutex);
+
+		if (!sqlite3_get_autocommit(db_)) {
+			sqlite3_mutex_leave(mutex);
+			return true;
+		}
+
+		table result;
+		bool success = sqlite_query("BEGIN IMMEDIATE;", result, error);
+
+		for (size_t i = 0; success && i < hot_tables_.size(); i++) {
+			const auto& table_ = hot_tables_[i];
+			const std::string disk = "main." + table_.name;
+			const std::string hot = "temp." + table_.name;
+			const std::string dirty = "(SELECT id FROM temp.hlib_dirty_" + table_.name + ")";
+
+			std::string columns;
+			for (const auto& col : table_.columns)
+				columns += (columns.empty() ? "" : ",") + col.name;
+
+			// deleted rows first, so that their keys are free for the others
+			success = sqlite_query("DELETE FROM " + disk + " WHERE rowid IN " + dirty +
+				" AND rowid NOT IN (SELECT rowid FROM " + hot + ");", result, error) &&
+				sqlite_query("UPDATE " + disk + " SET (" + columns + ") = (SELECT " + columns + " FROM " + hot +
+					" AS hot WHERE hot.rowid = " + disk + ".rowid) WHERE rowid IN " + dirty + ";", result, error) &&
+				sqlite_query("INSERT INTO " + disk + "(rowid," + columns + ") SELECT rowid," + columns + " FROM " + hot +
+					" WHERE rowid IN " + dirty + " AND rowid NOT IN (SELECT rowid FROM " + disk + ");", result, error) &&
+				sqlite_query("DELETE FROM temp.hlib_dirty_" + table_.name + ";", result, error);
+		}
+
+		if (success)
+			success = sqlite_query("COMMIT;", result, error);
+
+		if (!success && !sqlite3_get_autocommit(db_)) {
+			std::string rollback_error;
+			sqlite_query("ROLLBACK;", result, rollback_error);
+		}
+
+		sqlite3_mutex_leave(mutex);
+		return success;
+	}
+
+	void flush_periodically(std::chrono::milliseconds interval) {
+		std::unique_lock<std::mutex> lock(flush_lock_);
+		while (!flush_wait_.wait_for(lock, interval, [this]() { return flush_stop_; })) {
+			lock.unlock();
+
+			// a failed flush leaves the rows dirty, they go with the next one
+			std::string error;
+			flush(error);
+
+			lock.lock();
+		}
+	}
+
+	void stop_flush() {
+		if (!flush_thread_.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(flush_lock_);
+			flush_stop_ = true;
+		}
+
+		flush_wait_.notify_one();
+		flush_thread_.join();
+	}
+
+	bool take_read_connection(sqlite3*& db,
+		std::string& error) {
+		db = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(read_connections_lock_);
+			if (!read_connections_.empty()) {
+				db = read_connections_.back();
+				read_connections_.pop_back();
+			}
+		}
+
+		if (!db && !open_database(database_, db, error, true))
+			return false;
+
+		// an idle connection may predate a registration, so all are applied
+		std::lock_guard<std::mutex> lock(functions_lock_);
+		for (const auto& registration : functions_) {
+			const int code = register_function(db, registration);
+			if (code != SQLITE_OK) {
+				error = sqlite_error(code);
+				sqlite3_close(db);
+				db = nullptr;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void return_read_connection(sqlite3* db) {
+		// one that is still in a transaction is not reused
+		if (sqlite3_get_autocommit(db)) {
+			std::lock_guard<std::mutex> lock(read_connections_lock_);
+			if (read_connections_.size() < idle_read_connections_) {
+				read_connections_.push_back(db);
+				return;
+			}
+		}
+
+		sqlite3_close(db);
+	}
+
+	// BEGIN alone only takes the read lock at the first read
+	bool begin_read(sqlite3* db,
+		std::string& error) {
+		if (sqlite3_exec(db, "BEGIN; SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL) != SQLITE_OK) {
+			error = sqlite_error(db);
+			sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+			return false;
+		}
+		return true;
+	}
+
+	void end_read(sqlite3* db) {
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+		return_read_connection(db);
+	}
+
+	// maintenance statements hold the connection and leave an open transaction
+	// alone, like flush
+	bool optimize(std::string& error) {
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+		sqlite3_mutex_enter(mutex);
+
+		table result;
+		bool success = true;
+
+		if (sqlite3_get_autocommit(db_)) {
+			success = sqlite_query("PRAGMA optimize;", result, error);
+			if (success)
+				optimizes_++;
+		}
+
+		sqlite3_mutex_leave(mutex);
+		return success;
+	}
+
+	bool incremental_vacuum(int pages, std::string& error) {
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+		sqlite3_mutex_enter(mutex);
+
+		table before, after, result;
+		bool success = true;
+
+		if (sqlite3_get_autocommit(db_)) {
+			success = sqlite_query("PRAGMA main.freelist_count;", before, error);
+
+			if (success && !before.empty() && before[0]["freelist_count"] != "0") {
+				success = sqlite_query("PRAGMA main.incremental_vacuum(" + std::to_string(pages) + ");", result, error) &&
+					sqlite_query("PRAGMA main.freelist_count;", after, error);
+
+				if (success && !after.empty()) {
+					vacuums_++;
+					pages_vacuumed_ += std::stoll(before[0]["freelist_count"]) - std::stoll(after[0]["freelist_count"]);
+				}
+			}
+		}
+
+		sqlite3_mutex_leave(mutex);
+		return success;
+	}
+
+	bool start_maintenance(const maintenance_policy_& policy,
+		std::string& error) {
+		if (maintenance_thread_.joinable()) {
+			error = "Maintenance is already running";
+			return false;
+		}
+
+		maintenance_settings_ = policy;
+
+		// vacuum needs auto_vacuum = INCREMENTAL, see file_::incremental_vacuum
+		table result;
+		if (!sqlite_query("PRAGMA main.auto_vacuum;", result, error))
+			return false;
+
+		if (result.empty() || result[0]["auto_vacuum"] != "2")
+			maintenance_settings_.vacuum_pages = 0;
+
+		maintenance_stop_ = false;
+		maintenance_thread_ = std::thread(&hbase_impl::maintain_periodically, this);
+		return true;
+	}
+
+	// idle means no rows were changed on the connection for idle_ms, which is
+	// read from sqlite's change counter at every poll
+	void maintain_periodically() {
+		const auto poll = std::chrono::milliseconds(std::max(1, maintenance_settings_.poll_interval_ms));
+		const auto optimize_interval = std::chrono::milliseconds(maintenance_settings_.optimize_interval_ms);
+		const auto idle = std::chrono::milliseconds(std::max(0, maintenance_settings_.idle_ms));
+
+		auto last_optimize = clock_::now();
+		auto last_change = clock_::now();
+		int changes = sqlite3_total_changes(db_);
+
+		std::unique_lock<std::mutex> lock(maintenance_lock_);
+		while (!maintenance_wait_.wait_for(lock, poll, [this]() { return maintenance_stop_; })) {
+			lock.unlock();
+
+			const auto now = clock_::now();
+			const int current = sqlite3_total_changes(db_);
+			if (current != changes) {
+				changes = current;
+				last_change = now;
+			}
+
+			// failures are tried again at the next interval
+			std::string error;
+			if (optimize_interval.count() > 0 && now - last_optimize >= optimize_interval) {
+				optimize(error);
+				last_optimize = now;
+			}
+
+			if (maintenance_settings_.vacuum_pages > 0 && now - last_change >= idle)
+				incremental_vacuum(maintenance_settings_.vacuum_pages, error);
+
+			lock.lock();
+		}
+	}
+
+	void stop_maintenance() {
+		if (!maintenance_thread_.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(maintenance_lock_);
+			maintenance_stop_ = true;
+		}
+
+		maintenance_wait_.notify_one();
+		maintenance_thread_.join();
+
+		std::string error;
+		if (maintenance_settings_.optimize_on_close && db_)
+			optimize(error);
+	}
+
+	bool maintenance_stats(maintenance_stats_& stats,
+		std::string& error) {
+		stats = maintenance_stats_();
+		stats.optimizes = optimizes_;
+		stats.vacuums = vacuums_;
+		stats.pages_vacuumed = pages_vacuumed_;
+
+		table result;
+		for (const auto& pragma : { "page_size", "page_count", "freelist_count", "auto_vacuum" }) {
+			if (!sqlite_query(std::string("PRAGMA main.") + pragma + ";", result, error) || result.empty())
+				return false;
+
+			const long long value = std::stoll(result[0][pragma]);
+			if (pragma == std::string("page_size"))
+				stats.page_size = value;
+			else
+				if (pragma == std::string("page_count"))
+					stats.page_count = value;
+				else
+					if (pragma == std::string("freelist_count"))
+						stats.freelist_pages = value;
+					else
+						stats.incremental_vacuum = value == 2;
+		}
+
+		if (stats.page_count == 0)
+			return true;
+
+		stats.freelist_ratio = static_cast<double>(stats.freelist_pages) / stats.page_count;
+
+		// free space inside the pages in use as well, where sqlite has the
+		// dbstat table. it reads every page of the file
+		std::string dbstat_error;
+		if (sqlite_query("SELECT sum(unused) AS unused FROM dbstat('main');", result, dbstat_error) && !result.empty()) {
+			const double unused = std::atof(result[0]["unused"].c_str());
+			stats.fragmentation = (stats.freelist_pages * stats.page_size + unused) /
+				(static_cast<double>(stats.page_count) * stats.page_size);
+		}
+		else
+			stats.fragmentation = stats.freelist_ratio;
+
+		return true;
+	}
+
+	// the whole main database, or a copy of some tables made in an attached
+	// in-memory database, in the sqlite file format
+	bool serialize(const std::vector<std::string>& table_names,
+		std::vector<unsigned char>& image,
+		std::string& error) {
+		image.clear();
+
+		if (!flush(error))
+			return false;
+
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+		sqlite3_mutex_enter(mutex);
+
+		std::string schema = "main";
+		table result;
+		bool success = true;
+
+		if (!table_names.empty()) {
+			schema = "hlib_snapshot";
+			success = sqlite_query("ATTACH ':memory:' AS " + schema + ";", result, error);
+
+			for (size_t i = 0; success && i < table_names.size(); i++) {
+				const auto& name = table_names[i];
+
+				// the table as it was created, in the snapshot
+				success = sqlite_query("SELECT sql FROM main.sqlite_master WHERE type = 'table' AND name = '" + name + "';",
+					result, error);
+				if (success && result.empty()) {
+					error = "No such table: " + name;
+					success = false;
+				}
+
+				if (success) {
+					std::string sql = result[0]["sql"];
+					const std::string create = "CREATE TABLE ";
+					if (sql.compare(0, create.length(), create) == 0)
+						sql.insert(create.length(), schema + ".");
+
+					// hot tables are read from memory
+					success = sqlite_query(sql + ";", result, error) &&
+						sqlite_query("INSERT INTO " + schema + "." + name + " SELECT * FROM " + name + ";", result, error);
+				}
+			}
+		}
+
+		if (success) {
+			sqlite3_int64 size = 0;
+			unsigned char* data = sqlite3_serialize(db_, schema.c_str(), &size, 0);
+			if (data) {
+				image.assign(data, data + size);
+				sqlite3_free(data);
+			}
+			else {
+				error = "Could not serialize the database";
+				success = false;
+			}
+		}
+
+		if (schema != "main") {
+			std::string detach_error;
+			sqlite_query("DETACH " + schema + ";", result, detach_error);
+		}
+
+		sqlite3_mutex_leave(mutex);
+		return success;
+	}
+
+	// an in-memory connection over an image. without copying, sqlite reads
+	// the caller's memory and the database is read only
+	bool open_image(const unsigned char* image,
+		size_t size,
+		bool copy,
+		std::string& error) {
+		if (sqlite3_open_v2(":memory:", &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK) {
+			error = sqlite_error();
+			sqlite3_close(db_);
+			db_ = nullptr;
+			return false;
+		}
+
+		unsigned char* data = const_cast<unsigned char*>(image);
+		unsigned int flags = SQLITE_DESERIALIZE_READONLY;
+		if (copy) {
+			data = static_cast<unsigned char*>(sqlite3_malloc64(size));
+			if (!data && size > 0) {
+				error = sqlite_error(SQLITE_NOMEM);
+				sqlite3_close(db_);
+				db_ = nullptr;
+				return false;
+			}
+			std::memcpy(data, image, size);
+			flags = SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE;
+		}
+
+		int error_code = sqlite3_deserialize(db_, "main", data, size, size, flags);
+
+		// check that it is a database
+		if (error_code == SQLITE_OK)
+			error_code = sqlite3_exec(db_, "SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL);
+
+		if (error_code == SQLITE_OK)
+			error_code = sqlite3_create_function_v2(db_, "hlib_row_hash", -1,
+				SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, &row_hash_function, nullptr, nullptr, nullptr);
+
+		if (error_code != SQLITE_OK) {
+			error = sqlite_error(error_code);
+			sqlite3_close(db_);
+			db_ = nullptr;
+			return false;
+		}
+
+		auto close = [&]() {
+			tables_.clear();
+			sqlite3_close(db_);
+			db_ = nullptr;
+			return false;
+		};
+
+		// the definitions of the tables, for the features that look them up.
+		// the prefixes are compared with substr as _ is a wildcard in LIKE
+		table result;
+		if (!sqlite_query("SELECT name FROM sqlite_master WHERE type = 'table' AND substr(name, 1, 7) <> 'sqlite_' "
+			"AND substr(name, 1, 5) <> 'hlib_';", result, error))
+			return close();
+
+		for (auto& row : result) {
+			table_ table_;
+			table_.name = row["name"];
+
+			table info;
+			if (!sqlite_query("SELECT name, pk FROM pragma_table_info('" + table_.name + "') ORDER BY cid;", info, error))
+				return close();
+
+			std::map<int, std::string> keys;
+			for (auto& column : info) {
+				if (column["name"] == row_hash_column)
+					table_.row_hash = true;
+				else {
+					column_ col;
+					col.name = column["name"];
+					table_.columns.push_back(col);
+				}
+
+				const int pk = std::atoi(column["pk"].c_str());
+				if (pk > 0)
+					keys[pk] = column["name"];
+			}
+
+			for (const auto& key : keys)
+				table_.primary_key.push_back(key.second);
+
+			tables_[table_.name] = table_;
+		}
+
+		database_ = file_();
+		database_.name = ":memory:";
+		return true;
+	}
+
+	static int wal_hook(void* data, sqlite3*, const char* database_name, int frames) {
+		auto& d = *static_cast<hbase_impl*>(data);
+
+		if (std::strcmp(database_name, "main") == 0) {
+			d.wal_frames_.store(frames, std::memory_order_relaxed);
+			d.last_commit_.store(clock_::now().time_since_epoch().count(), std::memory_order_relaxed);
+			d.wal_commits_.fetch_add(1, std::memory_order_release);
+		}
+		return SQLITE_OK;
+	}
+
+	bool start_checkpoints(const checkpoint_policy_& policy,
+		std::string& error) {
+		if (checkpoint_thread_.joinable()) {
+			error = "Checkpoints are already running";
+			return false;
+		}
+
+		table result;
+		if (!sqlite_query("PRAGMA main.journal_mode;", result, error))
+			return false;
+
+		if (result.empty() || result[0]["journal_mode"] != "wal") {
+			error = "The database is not in WAL mode";
+			return false;
+		}
+
+		// checkpoints need a connection of their own, so that they do not wait
+		// for the statements of this one
+		sqlite3* db = nullptr;
+		if (!open_database(database_, db, error))
+			return false;
+
+		checkpoint_settings_ = policy;
+		checkpoint_stop_ = false;
+		{
+			std::lock_guard<std::mutex> lock(checkpoint_stats_lock_);
+			checkpoint_totals_ = checkpoint_stats_();
+		}
+
+		// from now on the commits of this connection only report the wal size
+		sqlite3_wal_hook(db_, wal_hook, this);
+
+		checkpoint_thread_ = std::thread(&hbase_impl::checkpoint_periodically, this, db);
+		return true;
+	}
+
+	void checkpoint_periodically(sqlite3* db) {
+		const auto poll = std::chrono::milliseconds(std::max(1, checkpoint_settings_.poll_interval_ms));
+		const auto idle = std::chrono::milliseconds(std::max(0, checkpoint_settings_.idle_ms));
+
+		int mode = SQLITE_CHECKPOINT_PASSIVE;
+		if (checkpoint_settings_.mode == checkpoint_mode_::restart)
+			mode = SQLITE_CHECKPOINT_RESTART;
+		else
+			if (checkpoint_settings_.mode == checkpoint_mode_::truncate)
+				mode = SQLITE_CHECKPOINT_TRUNCATE;
+
+		// for the wal size in bytes
+		int page_size = 0;
+		sqlite3_stmt* statement = nullptr;
+		if (sqlite3_prepare_v2(db, "PRAGMA page_size;", -1, &statement, 0) == SQLITE_OK &&
+			sqlite3_step(statement) == SQLITE_ROW)
+			page_size = sqlite3_column_int(statement, 0);
+		sqlite3_finalize(statement);
+
+		unsigned long long checkpointed_commits = wal_commits_.load(std::memory_order_acquire);
+
+		std::unique_lock<std::mutex> lock(checkpoint_lock_);
+		while (!checkpoint_wait_.wait_for(lock, poll, [this]() { return checkpoint_stop_; })) {
+			const unsigned long long commits = wal_commits_.load(std::memory_order_acquire);
+			if (commits == checkpointed_commits)
+				continue;
+
+			// a big enough wal, or writes that have stopped for a while
+			const long long frames = wal_frames_.load(std::memory_order_relaxed);
+			const auto since_commit = clock_::now() - clock_::time_point(clock_::duration(last_commit_.load(std::memory_order_relaxed)));
+			if (frames < checkpoint_settings_.wal_pages && since_commit < idle)
+				continue;
+
+			lock.unlock();
+
+			const auto start = clock_::now();
+			int log = 0, checkpointed = 0;
+			const int code = sqlite3_wal_checkpoint_v2(db, "main", mode, &log, &checkpointed);
+			const double milliseconds = std::chrono::duration<double, std::milli>(clock_::now() - start).count();
+
+			{
+				std::lock_guard<std::mutex> stats_lock(checkpoint_stats_lock_);
+				auto& stats = checkpoint_totals_;
+				if (code == SQLITE_OK) {
+					stats.checkpoints++;
+					stats.pages_checkpointed += checkpointed > 0 ? checkpointed : 0;
+				}
+				else
+					stats.busy++;
+
+				stats.last_ms = milliseconds;
+				stats.total_ms += milliseconds;
+				stats.max_ms = std::max(stats.max_ms, milliseconds);
+				stats.wal_pages = log > 0 ? log : 0;
+				stats.wal_bytes = static_cast<unsigned long long>(stats.wal_pages) * page_size;
+			}
+
+			// busy checkpoints are tried again at the next poll
+			if (code == SQLITE_OK)
+				checkpointed_commits = commits;
+
+			lock.lock();
+		}
+
+		sqlite3_close(db);
+	}
+
+	void stop_checkpoints() {
+		if (!checkpoint_thread_.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(checkpoint_lock_);
+			checkpoint_stop_ = true;
+		}
+
+		checkpoint_wait_.notify_one();
+		checkpoint_thread_.join();
+
+		// back to sqlite's own checkpoints, at its default of 1000 pages
+		if (db_)
+			sqlite3_wal_autocheckpoint(db_, 1000);
+	}
+
+	// hot tables live in temp
+	std::string schema_of(const std::string& table_name) {
+		for (const auto& table_ : hot_tables_)
+			if (table_.name == table_name)
+				return "temp";
+		return "main";
+	}
+
+	// blob handles do not fire triggers, so the full text index of a
+	// searchable column would miss what is streamed into it
+	bool check_blob_column(const std::string& column_name,
+		const std::string& table_name,
+		std::string& error) {
+		auto it = tables_.find(table_name);
+		if (it == tables_.end())
+			return true;
+
+		for (const auto& col : it->second.columns)
+			if (col.name == column_name) {
+				if (col.searchable) {
+					error = "Blobs cannot be streamed into searchable columns";
+					return false;
+				}
+				return true;
+			}
+
+		error = "No such column: " + column_name;
+		return false;
+	}
+
+	bool find_rowid(const field_& field,
+		const std::string& table_name,
+		long long& rowid,
+		std::string& error) {
+		sqlite3_stmt* statement = nullptr;
+		if (sqlite3_prepare_v2(db_, ("SELECT rowid FROM " + table_name + " WHERE " + field.name + " = ?;").c_str(),
+			-1, &statement, 0) != SQLITE_OK) {
+			error = sqlite_error();
+			return false;
+		}
+
+		sqlite3_bind_text(statement, 1, field.value.c_str(), static_cast<int>(field.value.length()), SQLITE_TRANSIENT);
+
+		const int step = sqlite3_step(statement);
+		if (step == SQLITE_ROW)
+			rowid = sqlite3_column_int64(statement, 0);
+		else
+			error = step == SQLITE_DONE ? "No row matches " + field.name : sqlite_error();
+
+		sqlite3_finalize(statement);
+		return step == SQLITE_ROW;
+	}
+
+	// runs a blob write in a savepoint, with the connection held, so that no
+	// other statement sees the row before its blob is complete
+	bool in_blob_savepoint(std::function<bool(std::string&)> write,
+		std::string& error) {
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+		sqlite3_mutex_enter(mutex);
+
+		table result;
+		bool success = sqlite_query("SAVEPOINT hlib_blob;", result, error) && write(error);
+
+		if (success)
+			success = sqlite_query("RELEASE hlib_blob;", result, error);
+		else {
+			std::string rollback_error;
+			sqlite_query("ROLLBACK TO hlib_blob;", result, rollback_error);
+			sqlite_query("RELEASE hlib_blob;", result, rollback_error);
+		}
+
+		sqlite3_mutex_leave(mutex);
+		return success;
+	}
+
+	// fills the zeroblob of a row from writer, a chunk at a time
+	bool stream_into_blob(const std::string& table_name,
+		const std::string& column_name,
+		long long rowid,
+		size_t blob_size,
+		const blob_writer& writer,
+		std::string& error) {
+		sqlite3_blob* blob = nullptr;
+		if (sqlite3_blob_open(db_, schema_of(table_name).c_str(), table_name.c_str(), column_name.c_str(),
+			rowid, 1, &blob) != SQLITE_OK) {
+			error = sqlite_error();
+			sqlite3_blob_close(blob);
+			return false;
+		}
+
+		std::vector<unsigned char> buffer(std::min(blob_chunk_size_, std::max<size_t>(blob_size, 1)));
+		size_t offset = 0;
+		bool success = true;
+
+		while (offset < blob_size) {
+			const size_t wanted = std::min(buffer.size(), blob_size - offset);
+			const size_t written = writer(buffer.data(), wanted);
+
+			if (written == 0 || written > wanted) {
+				error = written == 0 ? "The blob writer ended after " + std::to_string(offset) + " of " +
+					std::to_string(blob_size) + " bytes" : "The blob writer wrote more than it was asked for";
+				success = false;
+				break;
+			}
+
+			if (sqlite3_blob_write(blob, buffer.data(), static_cast<int>(written), static_cast<int>(offset)) != SQLITE_OK) {
+				error = sqlite_error();
+				success = false;
+				break;
+			}
+			offset += written;
+		}
+
+		sqlite3_blob_close(blob);
+		if (!success)
+			return false;
+
+		// the blob is only complete now
+		auto it = tables_.find(table_name);
+		if (it != tables_.end() && it->second.row_hash) {
+			table result;
+			return sqlite_query("UPDATE " + table_name + " SET " + row_hash_column + " = " + row_hash_call(it->second) +
+				" WHERE rowid = " + std::to_string(rowid) + ";", result, error);
+		}
+		return true;
+	}
+
+	bool insert_blob(const std::vector<field_>& row,
+		const std::string& column_name,
+		size_t blob_size,
+		const blob_writer& writer,
+		const std::string& table_name,
+		std::string& error) {
+		if (!check_blob_column(column_name, table_name, error))
+			return false;
+
+		std::string columns, values;
+		for (const auto& field : row) {
+			columns += field.name + ",";
+			values += "?,";
+		}
+
+		const std::string sql = "INSERT INTO " + table_name + "(" + columns + column_name + ") VALUES (" +
+			values + "zeroblob(?));";
+
+		return in_blob_savepoint([&](std::string& error) {
+			sqlite3_stmt* statement = nullptr;
+			if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &statement, 0) != SQLITE_OK) {
+				error = sqlite_error();
+				return false;
+			}
+
+			int index = 1;
+			for (const auto& field : row)
+				sqlite3_bind_text(statement, index++, field.value.c_str(),
+					static_cast<int>(field.value.length()), SQLITE_TRANSIENT);
+			sqlite3_bind_int64(statement, index, static_cast<sqlite3_int64>(blob_size));
+
+			const bool inserted = sqlite3_step(statement) == SQLITE_DONE;
+			if (!inserted)
+				error = sqlite_error();
+			sqlite3_finalize(statement);
+
+			return inserted && stream_into_blob(table_name, column_name, sqlite3_last_insert_rowid(db_),
+				blob_size, writer, error);
+			}, error);
+	}
+
+	bool write_blob(const field_& field,
+		const std::string& column_name,
+		size_t blob_size,
+		const blob_writer& writer,
+		const std::string& table_name,
+		std::string& error) {
+		if (!check_blob_column(column_name, table_name, error))
+			return false;
+
+		return in_blob_savepoint([&](std::string& error) {
+			long long rowid = 0;
+			if (!find_rowid(field, table_name, rowid, error))
+				return false;
+
+			// a blob handle cannot change the size of a blob
+			table result;
+			return sqlite_query("UPDATE " + table_name + " SET " + column_name + " = zeroblob(" +
+				std::to_string(blob_size) + ") WHERE rowid = " + std::to_string(rowid) + ";", result, error) &&
+				stream_into_blob(table_name, column_name, rowid, blob_size, writer, error);
+			}, error);
+	}
+
+	// reads the blob of the row matching field, or only its size when there is
+	// no reader
+	bool read_blob(const field_& field,
+		const std::string& column_name,
+		const blob_reader& reader,
+		const std::string& table_name,
+		size_t& size,
+		std::string& error) {
+		sqlite3_mutex* mutex = sqlite3_db_mutex(db_);
+		sqlite3_mutex_enter(mutex);
+
+		long long rowid = 0;
+		if (!find_rowid(field, table_name, rowid, error)) {
+			sqlite3_mutex_leave(mutex);
+			return false;
+		}
+
+		sqlite3_blob* blob = nullptr;
+		if (sqlite3_blob_open(db_, schema_of(table_name).c_str(), table_name.c_str(), column_name.c_str(),
+			rowid, 0, &blob) != SQLITE_OK) {
+			error = sqlite_error();
+			sqlite3_blob_close(blob);
+			sqlite3_mutex_leave(mutex);
+			return false;
+		}
+
+		size = static_cast<size_t>(sqlite3_blob_bytes(blob));
+		bool success = true;
+
+		if (reader) {
+			std::vector<unsigned char> buffer(std::min(blob_chunk_size_, std::max<size_t>(size, 1)));
+
+			for (size_t offset = 0; offset < size;) {
+				const size_t chunk = std::min(buffer.size(), size - offset);
+				if (sqlite3_blob_read(blob, buffer.data(), static_cast<int>(chunk), static_cast<int>(offset)) != SQLITE_OK) {
+					error = sqlite_error();
+					success = false;
+					break;
+				}
+
+				offset += chunk;
+				if (!reader(buffer.data(), chunk))
+					break;
+			}
+		}
+
+		sqlite3_blob_close(blob);
+		sqlite3_mutex_leave(mutex);
+		return success;
+	}
+
+	static int function_flags(const function_flags_& flags) {
+		int text_flags = SQLITE_UTF8;
+		if (flags.deterministic)
+			text_flags |= SQLITE_DETERMINISTIC;
+#ifdef SQLITE_INNOCUOUS
+		if (flags.innocuous)
+			text_flags |= SQLITE_INNOCUOUS;
+#endif
+#ifdef SQLITE_DIRECTONLY
+		if (flags.direct_only)
+			text_flags |= SQLITE_DIRECTONLY;
+#endif
+		return text_flags;
+	}
+
+	// the registered functions are called through these. exceptions of any
+	// type must not reach sqlite, so they fail the statement instead
+	static void call_function(sqlite3_context* context, int count, sqlite3_value** values) {
+		auto& function = **static_cast<std::shared_ptr<scalar_function>*>(sqlite3_user_data(context));
+		function_arguments_ arguments(reinterpret_cast<void**>(values), count);
+		function_result_ result(context);
+
+		try {
+			function(arguments, result);
+		}
+		catch (const std::exception& e) {
+			sqlite3_result_error(context, e.what(), -1);
+		}
+		catch (...) {
+			sqlite3_result_error(context, "exception in custom function", -1);
+		}
+	}
+
+	// the state of an aggregate lives in sqlite's aggregate context, which only
+	// holds a pointer to it. a group without rows has no context
+	static void* aggregate_state(sqlite3_context* context, bool create) {
+		auto& callbacks = **static_cast<std::shared_ptr<aggregate_callbacks_>*>(sqlite3_user_data(context));
+		void** state = static_cast<void**>(sqlite3_aggregate_context(context, create ? sizeof(void*) : 0));
+
+		if (!state)
+			return nullptr;
+
+		if (!*state)
+			*state = callbacks.create();
+		return *state;
+	}
+
+	static void aggregate_step(sqlite3_context* context, int count, sqlite3_value** values) {
+		auto& callbacks = **static_cast<std::shared_ptr<aggregate_callbacks_>*>(sqlite3_user_data(context));
+
+		try {
+			void* state = aggregate_state(context, true);
+			if (!state) {
+				sqlite3_result_error_nomem(context);
+				return;
+			}
+
+			callbacks.step(state, function_arguments_(reinterpret_cast<void**>(values), count));
+		}
+		catch (const std::exception& e) {
+			sqlite3_result_error(context, e.what(), -1);
+		}
+		catch (...) {
+			sqlite3_result_error(context, "exception in custom function", -1);
+		}
+	}
+
+	static void aggregate_inverse(sqlite3_context* context, int count, sqlite3_value** values) {
+		auto& callbacks = **static_cast<std::shared_ptr<aggregate_callbacks_>*>(sqlite3_user_data(context));
+
+		try {
+			void* state = aggregate_state(context, true);
+			if (state)
+				callbacks.inverse(state, function_arguments_(reinterpret_cast<void**>(values), count));
+		}
+		catch (const std::exception& e) {
+			sqlite3_result_error(context, e.what(), -1);
+		}
+		catch (...) {
+			sqlite3_result_error(context, "exception in custom function", -1);
+		}
+	}
+
+	// the current result of a window function
+	static void aggregate_value(sqlite3_context* context) {
+		auto& callbacks = **static_cast<std::shared_ptr<aggregate_callbacks_>*>(sqlite3_user_data(context));
+		function_result_ result(context);
+
+		try {
+			void* state = aggregate_state(context, true);
+			if (state)
+				callbacks.result(state, result);
+		}
+		catch (const std::exception& e) {
+			sqlite3_result_error(context, e.what(), -1);
+		}
+		catch (...) {
+			sqlite3_result_error(context, "exception in custom function", -1);
+		}
+	}
+
+	static void aggregate_final(sqlite3_context* context) {
+		auto& callbacks = **static_cast<std::shared_ptr<aggregate_callbacks_>*>(sqlite3_user_data(context));
+		function_result_ result(context);
+
+		void* state = aggregate_state(context, false);
+		const bool empty = !state;
+
+		try {
+			// the result of a group without rows is that of a new state
+			if (empty)
+				state = callbacks.create();
+
+			callbacks.result(state, result);
+		}
+		catch (const std::exception& e) {
+			sqlite3_result_error(context, e.what(), -1);
+		}
+		catch (...) {
+			sqlite3_result_error(context, "exception in custom function", -1);
+		}
+
+		try {
+			if (state)
+				callbacks.destroy(state);
+		}
+		catch (...) {
+		}
+	}
+
+	// each connection holds a reference to the function, which sqlite drops
+	// when the function is replaced, the connection closes or the
+	// registration fails
+	static int register_function(sqlite3* db,
+		const function_registration_& registration) {
+		const char* name = registration.name.c_str();
+		const int flags = function_flags(registration.flags);
+
+		if (registration.function)
+			return sqlite3_create_function_v2(db, name, registration.arguments, flags,
+				new std::shared_ptr<scalar_function>(registration.function), &call_function, nullptr, nullptr,
+				[](void* data) { delete static_cast<std::shared_ptr<scalar_function>*>(data); });
+
+		auto data = new std::shared_ptr<aggregate_callbacks_>(registration.callbacks);
+		auto destroy = [](void* data) { delete static_cast<std::shared_ptr<aggregate_callbacks_>*>(data); };
+
+		// with an inverse it can also be used over a sliding window
+		return registration.callbacks->inverse ?
+			sqlite3_create_window_function(db, name, registration.arguments, flags, data,
+				&aggregate_step, &aggregate_final, &aggregate_value, &aggregate_inverse, destroy) :
+			sqlite3_create_function_v2(db, name, registration.arguments, flags, data,
+				nullptr, &aggregate_step, &aggregate_final, destroy);
+	}
+
+	// registers with the connection and keeps the registration for the read
+	// only connections, in place of one with the same name and arguments
+	bool register_function(const function_registration_& registration,
+		std::string& error) {
+		const int code = register_function(db_, registration);
+		if (code != SQLITE_OK) {
+			set_error(error, code);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(functions_lock_);
+		const std::string name = to_upper(registration.name);
+		auto it = std::find_if(functions_.begin(), functions_.end(), [&](const function_registration_& existing) {
+			return existing.arguments == registration.arguments && to_upper(existing.name) == name;
+			});
+
+		if (it != functions_.end())
+			*it = registration;
+		else
+			functions_.push_back(registration);
+		return true;
+	}
+
+	bool create_function(const std::string& name,
+		int arguments,
+		const function_flags_& flags,
+		scalar_function function,
+		std::string& error) {
+		if (!function) {
+			set_error(error, error_::invalid_argument);
+			return false;
+		}
+
+		function_registration_ registration;
+		registration.name = name;
+		registration.arguments = arguments;
+		registration.flags = flags;
+		registration.function = std::make_shared<scalar_function>(std::move(function));
+		return register_function(registration, error);
+	}
+
+	bool create_aggregate(const std::string& name,
+		int arguments,
+		const function_flags_& flags,
+		const aggregate_callbacks_& callbacks,
+		std::string& error) {
+		if (!callbacks.create || !callbacks.destroy || !callbacks.step || !callbacks.result) {
+			set_error(error, error_::invalid_argument);
+			return false;
+		}
+
+		function_registration_ registration;
+		registration.name = name;
+		registration.arguments = arguments;
+		registration.flags = flags;
+		registration.callbacks = std::make_shared<aggregate_callbacks_>(callbacks);
+		return register_function(registration, error);
+	}
+
+	std::string type_to_string(hbase::column_type_ type) {
+
+		std::string _type;
+		switch (type)
+		{
+		case column_type_::blob_:
+			_type = "BLOB";
+			break;
+		case column_type_::float_:
+			_type = "FLOAT";
+			break;
+		case column_type_::integer_:
+			_type = "INTEGER";
+			break;
+		case column_type_::text_:
+		default:
+			_type = "TEXT";
+			break;
+		}
+		return _type;
+	}
+
+	std::string constraint_to_string(constraint_ constraint) {
+
+		std::string _constraint;
+		switch (constraint)
+		{
+		case constraint_::not_null:
+			_constraint = "NOT NULL";
+			break;
+		default:
+			_constraint = "NULL";
+			break;
+		}
+		return _constraint;
+	}
+
+};
+
+bool hlib::hbase::connect(const file_& file,
+	std::vector<table_>& tables,
+	std::string& error) {
+
+	if (d_.connected_) 
+		return true;
+
+	if (!d_.open_database(file, d_.db_, error))
+		return false;
+
+	d_.database_ = file;
+
+	table table;
+
+	// only takes effect while the file has no tables
+	if (file.incremental_vacuum && !d_.sqlite_query("PRAGMA main.auto_vacuum = INCREMENTAL;", table, error))
+		return false;
+
+	// create tables
+	for (const auto& table_ : tables) {
+		if (table_.hot && (table_.row_hash || std::any_of(table_.columns.begin(), table_.columns.end(),
+			[](const column_& col) { return col.searchable; }))) {
+			error = "Hot table " + table_.name + " cannot have row hashes or searchable columns";
+			return false;
+		}
+
+		std::string sql = table_.name + "(";
+
+		for (const auto& col : table_.columns) 
+			sql += col.name + " " + d_.type_to_string(col.type) + " " + d_.constraint_to_string(col.constraint) + ",";
+
+		if (table_.row_hash)
+			sql += row_hash_column + " TEXT NULL,";
+		
+		std::string composite_key;
+		size_t count_keys = 1;
+		for (const auto key : table_.primary_key) {	
+			composite_key += key;
+
+			if (count_keys < table_.primary_key.size()) {
+				composite_key += ',';
+			}
+			count_keys++;
+		}
+
+		sql += "PRIMARY KEY (" + composite_key + "));";
+
+		if (!d_.sqlite_query("CREATE TABLE " + sql, table, error)) 
+			if (error.find("already exists") == std::string::npos) 
+				return false;
+
+		if (table_.hot && !d_.create_hot_table(table_, sql, error))
+			return false;
+
+		if (table_.row_hash && !d_.create_row_hash(table_, error))
+			return false;
+
+		const bool searchable = std::any_of(table_.columns.begin(), table_.columns.end(),
+			[](const column_& col) { return col.searchable; });
+
+		if (searchable && !d_.create_full_text(table_, error))
+			return false;
+
+		// the columns are no longer searchable
+		if (!searchable && !table_.hot && !d_.drop_full_text(table_.name, error))
+			return false;
+		
+		d_.tables_[table_.name] = table_;
+		sql.clear();
+	}
+
+	if (!d_.hot_tables_.empty())
+		d_.flush_thread_ = std::thread(&hbase_impl::flush_periodically, &d_,
+			std::chrono::milliseconds(std::max(1, file.hot_flush_interval_ms)));
+
+	d_.connected_ = true;
+	return true;
+}
+
+bool hlib::hbase::insert_row(const std::vector<field_>& row,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return insert_row(row, table_name, error);
+		});
+}
+
+bool hlib::hbase::insert_row(const std::vector<field_>& row,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	size_t index = 1;
+	std::string colums;
+	std::string values;
+
+	for (const auto& field : row) {
+		colums += field.name;
+		values += "'"+ field.value +"'";
+
+		if (index < row.size()) {
+			colums += ",";
+			values += ",";
+		}
+		index++;
+	}
+
+	// the row hash is computed by the insert itself
+	const std::string row_hash = d_.row_hash_expression(table_name, row, true);
+	if (!row_hash.empty()) {
+		colums += "," + row_hash_column;
+		values += "," + row_hash;
+	}
+
+	std::string sql = "INSERT INTO " + table_name + "(";
+	sql += (colums + ") VALUES (" + values + ");");
+
+	table table;
+	if (!d_.sqlite_query(sql, table, error)) 
+		return false;
+	
+	return true;
+}
+
+bool hlib::hbase::delete_row(const field_& field,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return delete_row(field, table_name, error);
+		});
+}
+
+bool hlib::hbase::delete_row(const field_& field,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	table table_;
+	std::string sql = "DELETE FROM " + table_name;
+	sql += " WHERE " + field.name + " = '" + field.value + "';";
+
+	if (!d_.sqlite_query(sql ,table_, error)) 
+		return false;
+
+	return true;
+}
+
+bool hlib::hbase::count_records(const field_& field, 
+	const std::string& table_name,
+	size_t& records,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return count_records(field, table_name, records, error);
+		});
+}
+
+bool hlib::hbase::count_records(const field_& field,
+	const std::string& table_name,
+	size_t& records,
+	std::error_code& error) {
+
+	std::vector<aggregate_row_> result;
+	if (!aggregate(result, { aggregate_() }, {}, { field }, table_name, error))
+		return false;
+
+	records = static_cast<size_t>(result[0].values[0].integer);
+	return true;
+}
+
+bool hlib::hbase::count_records(const std::string& table_name,
+	size_t& records,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return count_records(table_name, records, error);
+		});
+}
+
+bool hlib::hbase::count_records(const std::string& table_name,
+	size_t& records,
+	std::error_code& error) {
+
+	std::vector<aggregate_row_> result;
+	if (!aggregate(result, { aggregate_() }, {}, {}, table_name, error))
+		return false;
+
+	records = static_cast<size_t>(result[0].values[0].integer);
+	return true;
+}
+
+bool hlib::hbase::get_records(table& records,
+	const std::vector<field_>& compound_keys,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return get_records(records, compound_keys, table_name, error);
+		});
+}
+
+bool hlib::hbase::get_records(table& records,
+	const std::vector<field_>& compound_keys,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) { 
+		error = error_::not_connected;
+		return false; 
+	}
+
+	std::string keys;
+	int indx = 1;
+	for (const auto& key : compound_keys) {
+		keys += key.name + " = '" + key.value +"'";
+		if (indx < compound_keys.size())
+			keys += " AND ";
+		indx++;
+	}
+
+	std::string sql = "SELECT * FROM " + table_name;
+	sql += " WHERE " + keys + ";";
+
+	return d_.sqlite_query(sql, records, error, true);
+}
+
+
+bool hlib::hbase::get_records(table& records,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return get_records(records, table_name, error);
+		});
+}
+
+bool hlib::hbase::get_records(table& records,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	const std::string sql = "SELECT * FROM '" + table_name + "';";
+	return d_.sqlite_query(sql, records, error, true);
+}
+
+
+hlib::hbase::table hlib::hbase::get_records(const std::vector<field_>& compound_keys,
+	const std::string& table_name,
+	std::error_code& error) {
+	table records;
+	get_records(records, compound_keys, table_name, error);
+	return records;
+}
+
+hlib::hbase::table hlib::hbase::get_records(const std::string& table_name,
+	std::error_code& error) {
+	table records;
+	get_records(records, table_name, error);
+	return records;
+}
+
+bool hlib::hbase::get_records_with_sort_by(table& records,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return get_records_with_sort_by(records, sort_by_field, table_name, error);
+		});
+}
+
+bool hlib::hbase::get_records_with_sort_by(table& records,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	std::string sql = "SELECT * FROM " + table_name;
+
+	sql += " ORDER BY " + sort_by_field.name + ";";
+
+	return d_.sqlite_query(sql, records, error, true);
+}
+
+bool hlib::hbase::get_records_with_and_sort_by(table& records,
+	const std::vector<field_>& compound_keys,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return get_records_with_and_sort_by(records, compound_keys, sort_by_field, table_name, error);
+		});
+}
+
+bool hlib::hbase::get_records_with_and_sort_by(table& records,
+	const std::vector<field_>& compound_keys,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	std::string keys;
+	int indx = 1;
+	for (const auto& key : compound_keys) {
+		keys += key.name + " = '" + key.value + "'";
+		if (indx < compound_keys.size())
+			keys += " AND ";
+		indx++;
+	}
+
+	std::string sql = "SELECT * FROM " + table_name;
+	sql += " WHERE " + keys + " ORDER BY " + sort_by_field.name + ";";
+
+	return d_.sqlite_query(sql, records, error, true);
+}
+
+bool hlib::hbase::get_records_using_custom_query(table& records,
+	const std::string& custom_query_statement,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return get_records_using_custom_query(records, custom_query_statement, error);
+		});
+}
+
+bool hlib::hbase::get_records_using_custom_query(table& records,
+	const std::string& custom_query_statement,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	return d_.sqlite_query(custom_query_statement, records, error, true);
+}
+
+bool hlib::hbase::get_records_with_or_sort_by(table& records,
+	const std::vector<field_>& compound_keys,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return get_records_with_or_sort_by(records, compound_keys, sort_by_field, table_name, error);
+		});
+}
+
+bool hlib::hbase::get_records_with_or_sort_by(table& records,
+	const std::vector<field_>& compound_keys,
+	const field_& sort_by_field,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	std::string keys;
+	int indx = 1;
+	for (const auto& key : compound_keys) {
+		keys +=  key.name + " = '" + key.value + "'";
+		if (indx < compound_keys.size())
+			keys += " OR ";
+		indx++;
+	}
+
+	std::string sql = "SELECT * FROM " + table_name;
+	sql += " WHERE " + keys + " ORDER BY " + sort_by_field.name + ";";
+
+	return d_.sqlite_query(sql, records, error, true);
+}
+
+
+
+bool hlib::hbase::custom_query(const std::string& custom_query_, std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return custom_query(custom_query_, error);
+		});
+}
+
+bool hlib::hbase::custom_query(const std::string& custom_query_, std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
+	}
+
+	table table_;
+	return d_.sqlite_query(custom_query_, table_, error);
+}
+
+bool hlib::hbase::update_record(const field_& field,
+	const std::vector<field_>& row_update,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return update_record(field, row_update, table_name, error);
+		});
+}
+
+bool hlib::hbase::update_record(const field_& field,
+	const std::vector<field_>& row_update,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	error.clear();
+	if (!d_.connected_) { 
+		error = error_::not_connected;
+		return false; 
+	}
+
+	size_t index = 1;
+	std::string fields;
+	for (const auto& field_ : row_update) {
+		fields += field_.name + " = '" + field_.value + "'";
+
+		if (index < row_update.size())
+			fields += ",";
+		index++;
+	}
+
+	const std::string row_hash = d_.row_hash_expression(table_name, row_update, false);
+	if (!row_hash.empty())
+		fields += "," + row_hash_column + " = " + row_hash;
+
+	table table_;
+	std::string sql = "UPDATE " + table_name + " SET ";
+	sql += fields + " WHERE " + field.name + " = '" + field.value +"';";
+;
+	if (!d_.sqlite_query(sql, table_, error)) 
+		return false;
+
+	return true;
+}
+
+bool hlib::hbase::backup_to(const std::string& path,
+	int pages_per_step,
+	backup_progress progress,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	// the backup copies main, which must have the hot tables' rows
+	if (!d_.flush(error))
+		return false;
+
+	if (pages_per_step <= 0)
+		pages_per_step = -1;	// copy everything in a single step
+
+	// the target is keyed the same way as the source
+	file_ target_file = d_.database_;
+	target_file.name = path;
+
+	sqlite3* target = nullptr;
+	if (!d_.open_database(target_file, target, error))
+		return false;
+
+	sqlite3_backup* backup = sqlite3_backup_init(target, "main", d_.db_, "main");
+	if (!backup) {
+		error = d_.sqlite_error(target);
+		sqlite3_close(target);
+		return false;
+	}
+
+	int error_code = SQLITE_OK;
+	auto busy_since = clock_::time_point::max();
+	do {
+		error_code = sqlite3_backup_step(backup, pages_per_step);
+
+		if (progress)
+			progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup));
+
+		// the source has been busy for too long, the busy error is returned
+		if (error_code == SQLITE_BUSY || error_code == SQLITE_LOCKED) {
+			const auto now = clock_::now();
+			if (busy_since == clock_::time_point::max())
+				busy_since = now;
+			else
+				if (now - busy_since >= std::chrono::milliseconds(d_.backup_busy_timeout_))
+					break;
+		}
+		else
+			busy_since = clock_::time_point::max();
+
+		// release the source between steps so that writers are not starved
+		if (error_code == SQLITE_OK || error_code == SQLITE_BUSY || error_code == SQLITE_LOCKED)
+			sqlite3_sleep(d_.backup_step_pause_);
+	} while (error_code == SQLITE_OK || error_code == SQLITE_BUSY || error_code == SQLITE_LOCKED);
+
+	if (error_code == SQLITE_DONE)
+		error_code = sqlite3_backup_finish(backup);
+	else
+		sqlite3_backup_finish(backup);
+
+	if (error_code != SQLITE_OK) {
+		error = d_.sqlite_error(error_code);
+		sqlite3_close(target);
+		return false;
+	}
+
+	sqlite3_close(target);
+	return true;
+}
+
+void hlib::hbase::enable_stats(bool enable) {
+	std::lock_guard<std::mutex> lock(d_.stats_lock_);
+	d_.stats_enabled_ = enable;
+	d_.update_instrument();
+}
+
+void hlib::hbase::reset_stats() {
+	std::lock_guard<std::mutex> lock(d_.stats_lock_);
+	d_.stats_.clear();
+}
+
+std::vector<hlib::hbase::query_stats_> hlib::hbase::stats() {
+	std::vector<query_stats_> snapshot;
+
+	std::lock_guard<std::mutex> lock(d_.stats_lock_);
+	snapshot.reserve(d_.stats_.size());
+
+	for (const auto& it : d_.stats_) {
+		const auto& stats = it.second;
+
+		query_stats_ query_stats;
+		query_stats.statement = it.first;
+		query_stats.calls = stats.calls;
+		query_stats.errors = stats.errors;
+		query_stats.rows = stats.rows;
+		query_stats.bytes = stats.bytes;
+		query_stats.prepare_ms = stats.prepare_time / 1e6;
+		query_stats.step_ms = stats.step_time / 1e6;
+		query_stats.materialize_ms = stats.materialize_time / 1e6;
+		query_stats.p50_ms = stats.latency.percentile(0.5) / 1e6;
+		query_stats.p99_ms = stats.latency.percentile(0.99) / 1e6;
+		query_stats.p999_ms = stats.latency.percentile(0.999) / 1e6;
+		snapshot.push_back(query_stats);
+	}
+
+	// most expensive statements first
+	std::sort(snapshot.begin(), snapshot.end(), [](const query_stats_& a, const query_stats_& b) {
+		return a.prepare_ms + a.step_ms + a.materialize_ms > b.prepare_ms + b.step_ms + b.materialize_ms;
+		});
+
+	return snapshot;
+}
+
+void hlib::hbase::on_slow_query(double threshold_ms,
+	slow_query_callback callback) {
+	std::lock_guard<std::mutex> lock(d_.stats_lock_);
+	d_.slow_query_threshold_ = threshold_ms;
+	d_.slow_query_callback_ = callback;
+	d_.update_instrument();
+}
+
+void hlib::hbase::capture_plans(double threshold_ms) {
+	std::lock_guard<std::mutex> lock(d_.stats_lock_);
+	d_.plan_threshold_ = threshold_ms;
+	d_.update_instrument();
+}
+
+void hlib::hbase::reset_plans() {
+	std::lock_guard<std::mutex> lock(d_.stats_lock_);
+	d_.plans_.clear();
+}
+
+std::vector<hlib::hbase::query_plan_> hlib::hbase::query_plans() {
+	std::vector<query_plan_> plans;
+	{
+		std::lock_guard<std::mutex> lock(d_.stats_lock_);
+		plans.reserve(d_.plans_.size());
+
+		for (const auto& it : d_.plans_) {
+			query_plan_ plan;
+			plan.statement = it.first;
+			plan.plan = it.second.plan;
+			plan.full_scans = it.second.full_scans;
+			plan.temp_b_tree = it.second.temp_b_tree;
+			plan.calls = it.second.calls;
+			plan.total_ms = it.second.total_ms;
+			plans.push_back(plan);
+		}
+	}
+
+	std::sort(plans.begin(), plans.end(), [](const query_plan_& a, const query_plan_& b) {
+		return a.total_ms > b.total_ms;
+		});
+
+	return plans;
+}
+
+std::vector<hlib::hbase::index_advice_> hlib::hbase::index_advice() {
+	std::vector<index_advice_> advice;
+
+	// the same index can serve several statement shapes
+	for (const auto& plan : query_plans()) {
+		std::vector<std::pair<std::string, std::vector<std::string>>> indexes;
+		{
+			std::lock_guard<std::mutex> lock(d_.stats_lock_);
+			auto it = d_.plans_.find(plan.statement);
+			if (it != d_.plans_.end())
+				indexes = it->second.indexes;
+		}
+
+		for (const auto& index : indexes) {
+			auto it = std::find_if(advice.begin(), advice.end(), [&index](const index_advice_& a) {
+				return a.table_name == index.first && a.columns == index.second;
+				});
+
+			if (it == advice.end()) {
+				index_advice_ a;
+				a.table_name = index.first;
+				a.columns = index.second;
+				advice.push_back(a);
+				it = advice.end() - 1;
+			}
+
+			it->calls += plan.calls;
+			it->total_ms += plan.total_ms;
+			if (std::find(plan.full_scans.begin(), plan.full_scans.end(), index.first) != plan.full_scans.end())
+				it->full_scans += plan.calls;
+			if (plan.temp_b_tree)
+				it->temp_b_trees += plan.calls;
+			it->statements.push_back(plan.statement);
+		}
+	}
+
+	// the leading columns of an index serve on their own, so an index on (a)
+	// is folded into one on (a, b)
+	auto starts_with = [](const std::vector<std::string>& columns, const std::vector<std::string>& prefix) {
+		return prefix.size() <= columns.size() && std::equal(prefix.begin(), prefix.end(), columns.begin());
+	};
+
+	for (size_t i = 0; i < advice.size();) {
+		auto wider = std::find_if(advice.begin(), advice.end(), [&](const index_advice_& a) {
+			return &a != &advice[i] && a.table_name == advice[i].table_name &&
+				a.columns.size() > advice[i].columns.size() && starts_with(a.columns, advice[i].columns);
+			});
+
+		if (wider != advice.end()) {
+			wider->calls += advice[i].calls;
+			wider->total_ms += advice[i].total_ms;
+			wider->full_scans += advice[i].full_scans;
+			wider->temp_b_trees += advice[i].temp_b_trees;
+			wider->statements.insert(wider->statements.end(), advice[i].statements.begin(), advice[i].statements.end());
+			advice.erase(advice.begin() + i);
+		}
+		else
+			i++;
+	}
+
+	// leave out what an existing index already covers, e.g. one created since
+	// the plans were captured
+	std::map<std::string, std::vector<std::vector<std::string>>> existing;
+	for (auto it = advice.begin(); it != advice.end();) {
+		// read directly so that the advice does not show up in the plans
+		if (!existing.count(it->table_name) && d_.db_) {
+			auto& indexes = existing[it->table_name];
+
+			sqlite3_stmt* statement = nullptr;
+			if (sqlite3_prepare_v2(d_.db_, "SELECT il.name, ii.name FROM pragma_index_list(?) AS il, "
+				"pragma_index_info(il.name) AS ii ORDER BY il.name, ii.seqno;", -1, &statement, 0) == SQLITE_OK) {
+				sqlite3_bind_text(statement, 1, it->table_name.c_str(), -1, SQLITE_TRANSIENT);
+
+				std::string current;
+				while (sqlite3_step(statement) == SQLITE_ROW) {
+					const char* index_name = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+					const char* column_name = reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+
+					if (indexes.empty() || current != (index_name ? index_name : "")) {
+						indexes.emplace_back();
+						current = index_name ? index_name : "";
+					}
+					indexes.back().push_back(to_upper(column_name ? column_name : ""));
+				}
+			}
+			sqlite3_finalize(statement);
+		}
+
+		std::vector<std::string> columns;
+		for (const auto& column : it->columns)
+			columns.push_back(to_upper(column.substr(0, column.find(' '))));
+
+		const auto& indexes = existing[it->table_name];
+		const bool covered = std::any_of(indexes.begin(), indexes.end(), [&](const std::vector<std::string>& index) {
+			return starts_with(index, columns);
+			});
+
+		if (covered)
+			it = advice.erase(it);
+		else
+			++it;
+	}
+
+	for (auto& a : advice) {
+		std::string name = "hlib_index_" + a.table_name;
+		std::string columns;
+		for (const auto& column : a.columns) {
+			name += "_" + column.substr(0, column.find(' '));
+			columns += (columns.empty() ? "" : ", ") + column;
+		}
+
+		a.create_statement = "CREATE INDEX IF NOT EXISTS " + name + " ON " + a.table_name + " (" + columns + ");";
+	}
+
+	std::sort(advice.begin(), advice.end(), [](const index_advice_& a, const index_advice_& b) {
+		return a.total_ms > b.total_ms;
+		});
+
+	return advice;
+}
+
+std::string hlib::hbase::index_report() {
+	std::ostringstream report;
+
+	const auto advice = index_advice();
+	report << "index advice" << std::endl;
+	if (advice.empty())
+		report << "  none" << std::endl;
+
+	for (const auto& a : advice) {
+		report << "  " << a.create_statement << std::endl
+			<< "    " << a.calls << " slow calls, " << a.total_ms << " ms, "
+			<< a.full_scans << " full scans, " << a.temp_b_trees << " temp b-trees" << std::endl;
+
+		for (const auto& statement : a.statements)
+			report << "    " << statement << std::endl;
+	}
+
+	report << std::endl << "slow statement plans" << std::endl;
+	for (const auto& plan : query_plans()) {
+		report << "  " << plan.statement << std::endl
+			<< "    " << plan.calls << " slow calls, " << plan.total_ms << " ms" << std::endl;
+
+		std::istringstream lines(plan.plan);
+		std::string line;
+		while (std::getline(lines, line))
+			report << "    " << line << std::endl;
+	}
+
+	return report.str();
+}
 
-	bool connected_;
-	sqlite3* db_;
+std::string hlib::hbase::derive_key(const std::string& password,
+	const std::string& salt,
+	int iterations) {
+	static std::mutex lock;
+	static std::map<std::string, std::string> keys;
 
-public:
-	hbase_impl() :
-		connected_(false),
-		db_(nullptr) {}
+	// the cache is indexed by a hash, not by the password itself
+	std::string id;
+	picosha2::hash256_hex_string(password + '\0' + salt + '\0' + std::to_string(iterations), id);
 
-	~hbase_impl() {
-		if (db_) {
-			// close database
-			sqlite3_close(db_);
-			db_ = nullptr;
-		}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto it = keys.find(id);
+		if (it != keys.end())
+			return it->second;
 	}
 
-	std::string sqlite_error(int error_code) {
-		std::string error = sqlite3_errstr(error_code);
-		if (error == "not an error") error.clear();
-		if (error.length() > 0) error[0] = toupper(error[0]);
-		return error;
-	}
+	const std::string key = pbkdf2_sha256(password, salt, iterations > 0 ? iterations : 1);
 
-	std::string sqlite_error() {
-		if (db_) {
-			std::string error = sqlite3_errmsg(db_);
-			if (error == "not an error") error.clear();
-			if (error.length() > 0) error[0] = toupper(error[0]);
-			return error;
-		}
-		else {
-			return "Database not open"; return false;
-		}
+	std::lock_guard<std::mutex> guard(lock);
+	keys[id] = key;
+	return key;
+}
+
+bool hlib::hbase::search(table& records,
+	const std::string& table_name,
+	const std::string& query,
+	size_t limit,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
 	}
 
-	bool sqlite_query(const std::string& query,
-		table& table,
-		std::string& error) {
-		table.clear();
+	auto it = d_.tables_.find(table_name);
+	if (it == d_.tables_.end() || std::none_of(it->second.columns.begin(), it->second.columns.end(),
+		[](const column_& col) { return col.searchable; })) {
+		error = "Table " + table_name + " has no searchable columns";
+		return false;
+	}
 
-		if (db_) {
-			sqlite3_stmt* statement = nullptr;
+	// best matches first
+	const std::string fts = "hlib_fts_" + table_name;
+	std::string sql = "SELECT " + table_name + ".* FROM " + fts + " JOIN " + table_name +
+		" ON " + table_name + ".rowid = " + fts + ".rowid WHERE " + fts + " MATCH ? ORDER BY rank";
+	if (limit > 0)
+		sql += " LIMIT " + std::to_string(limit);
+	sql += ";";
 
-			if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0) == SQLITE_OK) {
-				const int columns = sqlite3_column_count(statement);
+	const std::vector<field_> binds = { { "query", query } };
+	return d_.sqlite_query(sql, records, error, true, &binds);
+}
 
-				while (true) {
-					if (sqlite3_step(statement) == SQLITE_ROW) {
-						std::map<std::string, std::string> values;
+const std::string hlib::hbase::row_hash_column = "_row_hash";
 
-						for (int column = 0; column < columns; column++) {
-							std::string column_name, value;
+bool hlib::hbase::get_row_hashes(row_hashes& hashes,
+	const std::string& table_name,
+	std::string& error) {
 
-							// get column name
-							char* ccColumn = (char*)sqlite3_column_name(statement, column);
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
 
-							if (ccColumn) {
-								column_name = ccColumn;
+	return d_.get_row_hashes(table_name, hashes, error);
+}
 
-								// get data
-								char* ccData = (char*)sqlite3_column_text(statement, column);
+bool hlib::hbase::diff_table(row_diff_& diff,
+	const std::string& table_name,
+	hbase& other,
+	const std::string& other_table_name,
+	std::string& error) {
 
-								if (ccData)
-									value = ccData;
+	diff = row_diff_();
 
-								values.insert(std::make_pair(column_name, value));
-							}
-						}
+	row_hashes hashes, other_hashes;
+	if (!get_row_hashes(hashes, table_name, error) ||
+		!other.get_row_hashes(other_hashes, other_table_name, error))
+		return false;
 
-						table.push_back(values);
-					}
-					else
-						break;
-				}
-				sqlite3_finalize(statement);
+	// both maps are ordered by key, walk them side by side
+	auto it = hashes.begin();
+	auto other_it = other_hashes.begin();
+	while (it != hashes.end() || other_it != other_hashes.end()) {
+		if (other_it == other_hashes.end() || (it != hashes.end() && it->first < other_it->first)) {
+			diff.removed.push_back(it->first);
+			++it;
+		}
+		else
+			if (it == hashes.end() || other_it->first < it->first) {
+				diff.added.push_back(other_it->first);
+				++other_it;
 			}
 			else {
-				error = sqlite_error();
-				return false;
+				if (it->second != other_it->second)
+					diff.changed.push_back(it->first);
+				++it;
+				++other_it;
 			}
+	}
 
-			return true;
-		}
-		else {
-			error = "Database not open";
-			return false;
-		}
+	return true;
+}
+
+bool hlib::hbase::aggregate(std::vector<aggregate_row_>& result,
+	const std::vector<aggregate_>& aggregates,
+	const std::vector<std::string>& group_by,
+	const std::vector<field_>& filters,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.with_message(error, [&](std::error_code& error) {
+		return aggregate(result, aggregates, group_by, filters, table_name, error);
+		});
+}
+
+bool hlib::hbase::aggregate(std::vector<aggregate_row_>& result,
+	const std::vector<aggregate_>& aggregates,
+	const std::vector<std::string>& group_by,
+	const std::vector<field_>& filters,
+	const std::string& table_name,
+	std::error_code& error) {
+
+	result.clear();
+	error.clear();
+
+	if (!d_.connected_) {
+		error = error_::not_connected;
+		return false;
 	}
 
-	std::string type_to_string(hbase::column_type_ type) {
+	if (aggregates.empty()) {
+		error = error_::invalid_argument;
+		return false;
+	}
 
-		std::string _type;
-		switch (type)
-		{
-		case column_type_::blob_:
-			_type = "BLOB";
+	std::string groups;
+	for (const auto& column : group_by)
+		groups += (groups.empty() ? "" : ",") + column;
+
+	std::string sql = "SELECT " + groups;
+	for (size_t i = 0; i < aggregates.size(); i++) {
+		const auto& aggregate = aggregates[i];
+		if (!groups.empty() || i > 0)
+			sql += ",";
+
+		switch (aggregate.function) {
+		case aggregate_function_::sum_:
+			sql += "SUM(";
 			break;
-		case column_type_::float_:
-			_type = "FLOAT";
+		case aggregate_function_::avg_:
+			sql += "AVG(";
 			break;
-		case column_type_::integer_:
-			_type = "INTEGER";
+		case aggregate_function_::min_:
+			sql += "MIN(";
 			break;
-		case column_type_::text_:
+		case aggregate_function_::max_:
+			sql += "MAX(";
+			break;
+		case aggregate_function_::count_:
 		default:
-			_type = "TEXT";
+			sql += "COUNT(";
 			break;
 		}
-		return _type;
+		sql += (aggregate.column.empty() ? "*" : aggregate.column) + ")";
 	}
 
-	std::string constraint_to_string(constraint_ constraint) {
+	sql += " FROM " + table_name;
 
-		std::string _constraint;
-		switch (constraint)
-		{
-		case constraint_::not_null:
-			_constraint = "NOT NULL";
-			break;
-		default:
-			_constraint = "NULL";
-			break;
-		}
-		return _constraint;
-	}
+	for (size_t i = 0; i < filters.size(); i++)
+		sql += (i == 0 ? " WHERE " : " AND ") + filters[i].name + " = ?";
 
-};
+	if (!groups.empty())
+		sql += " GROUP BY " + groups + " ORDER BY " + groups;
+	sql += ";";
 
-bool hlib::hbase::connect(const file_& file,
-	std::vector<table_>& tables,
+	return d_.aggregate(sql, filters, group_by.size(), aggregates.size(), result, error);
+}
+
+bool hlib::hbase::subscribe(change_callback callback,
+	int& subscription,
 	std::string& error) {
 
-	if (d_.connected_) 
-		return true;
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
 
-	int error_code = 0;
-	if (file.password.empty()) {
-		error_code = sqlite3_open_v2(file.name.c_str(), &d_.db_,
-			SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, NULL);
-		error_code = sqlite3_exec(d_.db_, "SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL);
+	if (!callback) {
+		error = "No callback";
+		return false;
 	}
-	else {
-		error_code = sqlite3_open_v2(file.name.c_str(), &d_.db_,
-			SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, NULL);
 
-		sqlite3_stmt* stm = nullptr;
-		const char* pzTail = nullptr;
+	std::lock_guard<std::mutex> lock(d_.subscribers_lock_);
+	if (d_.subscribers_.empty())
+		d_.set_change_hooks(true);
 
-		// key the database
-		auto pragma_string = "PRAGMA key = '" + file.password + "';";
-		sqlite3_prepare(d_.db_, pragma_string.c_str(), -1, &stm, &pzTail);
-		sqlite3_step(stm);
-		sqlite3_finalize(stm);
+	subscription = d_.next_subscription_++;
+	d_.subscribers_[subscription] = std::move(callback);
+	return true;
+}
 
-		// test if key is correct
-		error_code = sqlite3_exec(d_.db_, "SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL);
-	}
+void hlib::hbase::unsubscribe(int subscription) {
+	std::lock_guard<std::mutex> lock(d_.subscribers_lock_);
+	if (d_.subscribers_.erase(subscription) && d_.subscribers_.empty())
+		d_.set_change_hooks(false);
+}
 
-	if (error_code != SQLITE_OK) {
-		// an error occured
-		error = d_.sqlite_error(error_code);
+bool hlib::hbase::serialize(std::vector<unsigned char>& image,
+	const std::vector<std::string>& table_names,
+	std::string& error) {
 
-		// close database
-		sqlite3_close(d_.db_);
-		d_.db_ = nullptr;
+	if (!d_.connected_) {
+		error = "Not connected to database";
 		return false;
 	}
 
-	// create tables
-	table table;
-	for (const auto& table_ : tables) {
-		std::string sql = "CREATE TABLE " + table_.name + "(";
-
-		for (const auto& col : table_.columns) 
-			sql += col.name + " " + d_.type_to_string(col.type) + " " + d_.constraint_to_string(col.constraint) + ",";
-		
-		std::string composite_key;
-		size_t count_keys = 1;
-		for (const auto key : table_.primary_key) {	
-			composite_key += key;
+	return d_.serialize(table_names, image, error);
+}
 
-			if (count_keys < table_.primary_key.size()) {
-				composite_key += ',';
-			}
-			count_keys++;
-		}
+bool hlib::hbase::serialize_to(const std::string& path,
+	const std::vector<std::string>& table_names,
+	std::string& error) {
 
-		sql += "PRIMARY KEY (" + composite_key + "));";
+	std::vector<unsigned char> image;
+	if (!serialize(image, table_names, error))
+		return false;
 
-		if (!d_.sqlite_query(sql, table, error)) 
-			if (error.find("already exists") == std::string::npos) 
-				return false;
-		
-		sql.clear();
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.write(reinterpret_cast<const char*>(image.data()), image.size()) || !file.flush()) {
+		error = "Could not write " + path;
+		return false;
 	}
+	return true;
+}
+
+bool hlib::hbase::connect(const unsigned char* image,
+	size_t size,
+	bool copy,
+	std::string& error) {
+
+	if (d_.connected_)
+		return true;
+
+	if (!d_.open_image(image, size, copy, error))
+		return false;
 
 	d_.connected_ = true;
 	return true;
 }
 
-bool hlib::hbase::insert_row(std::vector<field_>& row,
-	const std::string& table_name,
+bool hlib::hbase::start_checkpoints(const checkpoint_policy_& policy,
 	std::string& error) {
 
 	if (!d_.connected_) {
-		error = "Not connected to database"; 
+		error = "Not connected to database";
 		return false;
 	}
 
-	size_t index = 1;
-	std::string colums;
-	std::string values;
+	return d_.start_checkpoints(policy, error);
+}
 
-	for (const auto& field : row) {
-		colums += field.name;
-		values += "'"+ field.value +"'";
+void hlib::hbase::stop_checkpoints() {
+	d_.stop_checkpoints();
+}
 
-		if (index < row.size()) {
-			colums += ",";
-			values += ",";
-		}
-		index++;
+hlib::hbase::checkpoint_stats_ hlib::hbase::checkpoint_stats() {
+	std::lock_guard<std::mutex> lock(d_.checkpoint_stats_lock_);
+	return d_.checkpoint_totals_;
+}
+
+hlib::hbase::function_arguments_::function_arguments_(void** values, int count) :
+	values_(values), count_(count) {}
+
+int hlib::hbase::function_arguments_::count() const {
+	return count_;
+}
+
+bool hlib::hbase::function_arguments_::is_null(int index) const {
+	return sqlite3_value_type(static_cast<sqlite3_value*>(values_[index])) == SQLITE_NULL;
+}
+
+long long hlib::hbase::function_arguments_::integer(int index) const {
+	return sqlite3_value_int64(static_cast<sqlite3_value*>(values_[index]));
+}
+
+double hlib::hbase::function_arguments_::real(int index) const {
+	return sqlite3_value_double(static_cast<sqlite3_value*>(values_[index]));
+}
+
+std::string hlib::hbase::function_arguments_::text(int index) const {
+	auto value = static_cast<sqlite3_value*>(values_[index]);
+	const char* text = reinterpret_cast<const char*>(sqlite3_value_text(value));
+	return std::string(text ? text : "", text ? sqlite3_value_bytes(value) : 0);
+}
+
+std::vector<unsigned char> hlib::hbase::function_arguments_::blob(int index) const {
+	auto value = static_cast<sqlite3_value*>(values_[index]);
+	const auto blob = static_cast<const unsigned char*>(sqlite3_value_blob(value));
+	return std::vector<unsigned char>(blob, blob ? blob + sqlite3_value_bytes(value) : blob);
+}
+
+hlib::hbase::function_result_::function_result_(void* context) :
+	context_(context) {}
+
+void hlib::hbase::function_result_::null() {
+	sqlite3_result_null(static_cast<sqlite3_context*>(context_));
+}
+
+void hlib::hbase::function_result_::integer(long long value) {
+	sqlite3_result_int64(static_cast<sqlite3_context*>(context_), value);
+}
+
+void hlib::hbase::function_result_::real(double value) {
+	sqlite3_result_double(static_cast<sqlite3_context*>(context_), value);
+}
+
+void hlib::hbase::function_result_::text(const std::string& value) {
+	sqlite3_result_text64(static_cast<sqlite3_context*>(context_), value.c_str(), value.length(),
+		SQLITE_TRANSIENT, SQLITE_UTF8);
+}
+
+void hlib::hbase::function_result_::blob(const std::vector<unsigned char>& value) {
+	sqlite3_result_blob64(static_cast<sqlite3_context*>(context_), value.data(), value.size(), SQLITE_TRANSIENT);
+}
+
+void hlib::hbase::function_result_::error(const std::string& message) {
+	sqlite3_result_error(static_cast<sqlite3_context*>(context_), message.c_str(), static_cast<int>(message.length()));
+}
+
+bool hlib::hbase::create_function(const std::string& name,
+	int arguments,
+	const function_flags_& flags,
+	scalar_function function,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
 	}
 
-	std::string sql = "INSERT INTO " + table_name + "(";
-	sql += (colums + ") VALUES (" + values + ");");
+	return d_.create_function(name, arguments, flags, std::move(function), error);
+}
 
-	table table;
-	if (!d_.sqlite_query(sql, table, error)) 
+bool hlib::hbase::create_aggregate(const std::string& name,
+	int arguments,
+	const function_flags_& flags,
+	const aggregate_callbacks_& callbacks,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
 		return false;
-	
-	return true;
+	}
+
+	return d_.create_aggregate(name, arguments, flags, callbacks, error);
 }
 
-bool hlib::hbase::delete_row(const field_& field,
+bool hlib::hbase::insert_blob(const std::vector<field_>& row,
+	const std::string& column_name,
+	size_t blob_size,
+	blob_writer writer,
 	const std::string& table_name,
 	std::string& error) {
 
 	if (!d_.connected_) {
-		error = "Not connected to database"; 
+		error = "Not connected to database";
 		return false;
 	}
 
-	table table_;
-	std::string sql = "DELETE FROM " + table_name;
-	sql += " WHERE " + field.name + " = '" + field.value + "';";
+	return d_.insert_blob(row, column_name, blob_size, writer, table_name, error);
+}
 
-	if (!d_.sqlite_query(sql ,table_, error)) 
+bool hlib::hbase::write_blob(const field_& field,
+	const std::string& column_name,
+	size_t blob_size,
+	blob_writer writer,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
+	}
+
+	return d_.write_blob(field, column_name, blob_size, writer, table_name, error);
+}
+
+bool hlib::hbase::read_blob(const field_& field,
+	const std::string& column_name,
+	blob_reader reader,
+	const std::string& table_name,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
 		return false;
+	}
 
-	return true;
+	size_t size = 0;
+	return d_.read_blob(field, column_name, reader, table_name, size, error);
 }
 
-bool hlib::hbase::count_records(const field_& field, 
+bool hlib::hbase::blob_size(const field_& field,
+	const std::string& column_name,
 	const std::string& table_name,
-	size_t& records,
+	size_t& size,
 	std::string& error) {
 
 	if (!d_.connected_) {
@@ -304,97 +4507,92 @@ bool hlib::hbase::count_records(const field_& field,
 		return false;
 	}
 
-	table table_;
-	std::string sql = "SELECT COUNT(*) FROM  " + table_name;
-	sql += " WHERE " + field.name + " = '" + field.value + "';";
+	return d_.read_blob(field, column_name, nullptr, table_name, size, error);
+}
 
-	if (!d_.sqlite_query(sql, table_, error)) 
-		return false;
+bool hlib::hbase::configure_memory(const memory_config_& config,
+	std::string& error) {
+	std::lock_guard<std::mutex> lock(memory_config_lock);
 
-	try {
-		if (!table_.empty())
-			records = std::atoi(table_[0].at("COUNT(*)").c_str());
-		else {
-			error = "The table is empty!";
+	if (config.pooled_allocator && !pooled_allocator_installed) {
+		// sqlite only takes an allocator before it is initialized
+		if (sqlite3_config(SQLITE_CONFIG_MALLOC, &pooled_allocator::methods()) != SQLITE_OK) {
+			error = "The allocator has to be configured before the first connection";
 			return false;
 		}
-		return true;
-	}
-	catch (const std::exception & e) {
-		error = e.what();
-		return false;
+		pooled_allocator_installed = true;
 	}
+
+	pooled_allocator::instance().pool_limit = config.pool_limit_bytes;
+	if (pooled_allocator_installed && config.pool_limit_bytes == 0)
+		pooled_allocator::instance().release();
+
+	sqlite3_soft_heap_limit64(config.soft_heap_limit_bytes);
+	sqlite3_hard_heap_limit64(config.hard_heap_limit_bytes);
+	return true;
 }
 
-bool hlib::hbase::count_records(const std::string& table_name,
-	size_t& records,
-	std::string& error) {
+hlib::hbase::memory_report_ hlib::hbase::memory_report() {
+	memory_report_ report;
 
-	if (!d_.connected_) {
-		error = "Not connected to database";
-		return false;
+	if (d_.db_) {
+		int current = 0, highwater = 0;
+		auto status = [&](int operation) {
+			current = highwater = 0;
+			sqlite3_db_status(d_.db_, operation, &current, &highwater, 0);
+		};
+
+		status(SQLITE_DBSTATUS_CACHE_USED);
+		report.page_cache_bytes = current;
+		status(SQLITE_DBSTATUS_SCHEMA_USED);
+		report.schema_bytes = current;
+		status(SQLITE_DBSTATUS_STMT_USED);
+		report.statement_bytes = current;
+		status(SQLITE_DBSTATUS_LOOKASIDE_USED);
+		report.lookaside_slots_used = current;
+		status(SQLITE_DBSTATUS_LOOKASIDE_HIT);
+		report.lookaside_hits = highwater;
+		status(SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE);
+		report.lookaside_misses = highwater;
+		status(SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL);
+		report.lookaside_misses += highwater;
 	}
 
-	table table_;
-	std::string sql = "SELECT COUNT(*) FROM  '" + table_name + "';";
-	if (!d_.sqlite_query(sql, table_, error)) 
-		return false;
+	report.result_bytes = d_.result_bytes_.load(std::memory_order_relaxed);
+	report.result_bytes_peak = d_.result_bytes_peak_.load(std::memory_order_relaxed);
 
-	try {
-		if (!table_.empty())
-			records = std::atoi(table_[0].at("COUNT(*)").c_str());
-		else {
-			error = "The table is empty!";
-			return false;
-		}
-		return true;
-	}
-	catch (const std::exception & e) {
-		error = e.what();
-		return false;
-	}
+	report.sqlite_heap_bytes = sqlite3_memory_used();
+	report.sqlite_heap_peak = sqlite3_memory_highwater(0);
+	report.pooled_bytes = pooled_allocator::instance().pooled_bytes.load();
+	return report;
 }
 
-bool hlib::hbase::get_records(table& records,
-	const std::vector<field_>& compound_keys,
-	const std::string& table_name,
+bool hlib::hbase::start_maintenance(const maintenance_policy_& policy,
 	std::string& error) {
 
-	if (!d_.connected_) { 
-		error = "Not connected to database"; 
-		return false; 
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return false;
 	}
 
-	std::string keys;
-	int indx = 1;
-	for (auto key : compound_keys) {
-		keys += key.name + " = '" + key.value +"'";
-		if (indx < compound_keys.size())
-			keys += " AND ";
-		indx++;
-	}
+	return d_.start_maintenance(policy, error);
+}
 
-	table table_;
-	std::string sql = "SELECT * FROM " + table_name;
-	sql += " WHERE " + keys + ";";
+void hlib::hbase::stop_maintenance() {
+	d_.stop_maintenance();
+}
 
-	if (!d_.sqlite_query(sql, table_, error)) 
-		return false;
+bool hlib::hbase::optimize(std::string& error) {
 
-	if (!table_.empty()) {
-		for (const auto& row : table_) 
-			records.push_back(row);
-		return true;
-	}
-	else {
-		error = "the table is empty!";
+	if (!d_.connected_) {
+		error = "Not connected to database";
 		return false;
 	}
-}
 
+	return d_.optimize(error);
+}
 
-bool hlib::hbase::get_records(table& records,
-	const std::string& table_name,
+bool hlib::hbase::incremental_vacuum(int pages,
 	std::string& error) {
 
 	if (!d_.connected_) {
@@ -402,26 +4600,22 @@ bool hlib::hbase::get_records(table& records,
 		return false;
 	}
 
-	table table_;
-	const std::string sql = "SELECT * FROM '" + table_name + "';";
-	if (!d_.sqlite_query(sql, table_, error))
-		return false;
+	return d_.incremental_vacuum(pages, error);
+}
 
-	if (!table_.empty()) {
-		for (const auto row : table_)
-			records.push_back(row);
-		return true;
-	}
-	else {
-		error = "the table is empty!";
+bool hlib::hbase::maintenance_stats(maintenance_stats_& stats,
+	std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
 		return false;
 	}
-}
 
+	return d_.maintenance_stats(stats, error);
+}
 
-bool hlib::hbase::get_records_with_sort_by(table& records,
-	const field_& sort_by_field,
-	const std::string& table_name,
+bool hlib::hbase::start_capture(const std::string& path,
+	bool hash_values,
 	std::string& error) {
 
 	if (!d_.connected_) {
@@ -429,65 +4623,140 @@ bool hlib::hbase::get_records_with_sort_by(table& records,
 		return false;
 	}
 
-	table table_;
-	std::string sql = "SELECT * FROM " + table_name;
+	return d_.start_capture(path, hash_values, error);
+}
 
-	sql += " ORDER BY '" + sort_by_field.name + "';";
+void hlib::hbase::stop_capture() {
+	d_.stop_capture();
+}
 
-	if (!d_.sqlite_query(sql, table_, error))
-		return false;
+bool hlib::hbase::read_trace(const std::string& path,
+	std::vector<trace_record_>& records,
+	std::string& error) {
+	records.clear();
 
-	if (!table_.empty()) {
-		for (const auto& row : table_)
-			records.push_back(row);
-		return true;
-	}
-	else {
-		error = "the table is empty!";
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		error = "Cannot open " + path;
 		return false;
 	}
-}
-
-bool hlib::hbase::get_records_with_and_sort_by(table& records,
-	const std::vector<field_>& compound_keys,
-	const field_& sort_by_field,
-	const std::string& table_name,
-	std::string& error) {
 
-	if (!d_.connected_) {
-		error = "Not connected to database";
+	std::string magic(trace_magic.size(), '\0');
+	if (!file.read(&magic[0], static_cast<std::streamsize>(magic.size())) || magic != trace_magic) {
+		error = path + " is not a trace";
 		return false;
 	}
 
-	std::string keys;
-	int indx = 1;
-	for (auto key : compound_keys) {
-		keys += key.name + " = '" + key.value + "'";
-		if (indx < compound_keys.size())
-			keys += " AND ";
-		indx++;
+	std::vector<std::string> shapes;
+	int tag;
+	while ((tag = file.get()) != EOF) {
+		bool valid = true;
+
+		if (tag == 'S') {
+			unsigned long long id = 0;
+			std::string shape;
+			valid = get_varint(file, id) && get_string(file, shape) && id == shapes.size();
+			if (valid)
+				shapes.push_back(shape);
+		}
+		else
+			if (tag == 'O') {
+				trace_record_ record;
+				const int flags = file.get();
+				unsigned long long id = 0, thread = 0, start = 0, duration = 0, count = 0;
+
+				valid = flags != EOF && get_varint(file, id) && id < shapes.size() &&
+					get_varint(file, thread) && get_varint(file, start) && get_varint(file, duration) &&
+					get_varint(file, record.rows) && get_varint(file, count);
+
+				for (unsigned long long i = 0; valid && i < count; i++) {
+					trace_value_ value;
+					const int kind = file.get();
+					valid = kind >= 0 && kind <= 2 && get_string(file, value.value);
+					value.kind = static_cast<trace_value_::kind_>(kind);
+					record.values.push_back(std::move(value));
+				}
+
+				if (valid) {
+					record.statement = shapes[static_cast<size_t>(id)];
+					record.success = (flags & 1) != 0;
+					record.bound = (flags & 2) != 0;
+					record.thread = static_cast<unsigned>(thread);
+					record.start_ns = static_cast<long long>(start);
+					record.duration_ns = static_cast<long long>(duration);
+					records.push_back(std::move(record));
+				}
+			}
+			else
+				valid = false;
+
+		// a capture cut off mid record keeps what came before
+		if (!valid) {
+			if (file.eof())
+				break;
+
+			error = path + " is corrupt";
+			return false;
+		}
 	}
 
-	table table_;
-	std::string sql = "SELECT * FROM " + table_name;
-	sql += " WHERE " + keys + " ORDER BY '" + sort_by_field.name + "';";
+	return true;
+}
 
-	if (!d_.sqlite_query(sql, table_, error))
-		return false;
+std::string hlib::hbase::replay_statement(const trace_record_& record) {
+	std::string statement;
+	statement.reserve(record.statement.size());
 
-	if (!table_.empty()) {
-		for (const auto& row : table_)
-			records.push_back(row);
-		return true;
+	size_t next = 0;
+	for (size_t i = 0; i < record.statement.size(); i++) {
+		const char c = record.statement[i];
+
+		// quoted names and strings are copied as they are
+		if (c == '\'' || c == '"') {
+			const size_t end = record.statement.find(c, i + 1);
+			const size_t length = (end == std::string::npos ? record.statement.size() : end + 1) - i;
+			statement += record.statement.substr(i, length);
+			i += length - 1;
+			continue;
+		}
+
+		if (c != '?' || next >= record.values.size()) {
+			statement += c;
+			continue;
+		}
+
+		const auto& value = record.values[next++];
+		switch (value.kind) {
+		case trace_value_::kind_::number:
+			statement += value.value;
+			break;
+		case trace_value_::kind_::hash:
+			statement += "NULL";
+			break;
+		default:
+			statement += '\'';
+			for (const char v : value.value)
+				statement += v == '\'' ? std::string("''") : std::string(1, v);
+			statement += '\'';
+		}
 	}
-	else {
-		error = "the table is empty!";
+
+	return statement;
+}
+
+bool hlib::hbase::flush(std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
 		return false;
 	}
+
+	return d_.flush(error);
 }
 
-bool hlib::hbase::get_records_using_custom_query(table& records,
-	const std::string& custom_query_statement,
+bool hlib::hbase::parallel_scan(const std::string& table_name,
+	const scan_options_& options,
+	scan_callback callback,
 	std::string& error) {
 
 	if (!d_.connected_) {
@@ -495,108 +4764,236 @@ bool hlib::hbase::get_records_using_custom_query(table& records,
 		return false;
 	}
 
-	table table_;
-	if (!d_.sqlite_query(custom_query_statement, table_, error))
-		return false;
-
-	if (!table_.empty()) {
-		for (const auto& row : table_)
-			records.push_back(row);
-		return true;
-	}
-	else {
-		error = "the table is empty!";
+	if (!callback) {
+		error = "No callback";
 		return false;
 	}
+
+	return d_.parallel_scan(table_name, options, callback, error);
 }
 
-bool hlib::hbase::get_records_with_or_sort_by(table& records,
-	const std::vector<field_>& compound_keys,
-	const field_& sort_by_field,
+bool hlib::hbase::get_records(table& records,
 	const std::string& table_name,
+	const scan_options_& options,
 	std::string& error) {
 
-	if (!d_.connected_) {
-		error = "Not connected to database";
-		return false;
+	scan_options_ ordered = options;
+	ordered.ordered = true;
+
+	return parallel_scan(table_name, ordered, [&records](size_t, table& rows) {
+		std::move(rows.begin(), rows.end(), std::back_inserter(records));
+		return true;
+		}, error);
+}
+
+class hlib::hbase::read_session_::read_session_impl {
+public:
+	hbase& db_;
+	hbase_impl& owner_;
+
+	// the session's connections, and those no thread is using
+	std::vector<sqlite3*> connections_;
+	std::vector<sqlite3*> idle_;
+	std::mutex lock_;
+	std::condition_variable released_;
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+	sqlite3_snapshot* snapshot_ = nullptr;
+#endif
+
+	read_session_impl(hbase& db) :
+		db_(db),
+		owner_(db.d_) {}
+
+	~read_session_impl() {
+		for (auto db : connections_)
+			owner_.end_read(db);
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+		if (snapshot_)
+			sqlite3_snapshot_free(snapshot_);
+#endif
 	}
 
-	std::string keys;
-	int indx = 1;
-	for (auto key : compound_keys) {
-		keys +=  key.name + " = '" + key.value + "'";
-		if (indx < compound_keys.size())
-			keys += " OR ";
-		indx++;
+	void add(sqlite3* db) {
+		connections_.push_back(db);
+		idle_.push_back(db);
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+		// only in wal mode, otherwise the threads share the connection
+		if (sqlite3_snapshot_get(db, "main", &snapshot_) != SQLITE_OK)
+			snapshot_ = nullptr;
+#endif
 	}
 
-	table table_;
-	std::string sql = "SELECT * FROM " + table_name;
-	sql += " WHERE " + keys + " ORDER BY '" + sort_by_field.name + "';";
+	// an idle connection, a new one on the snapshot, or the next to be released
+	sqlite3* acquire() {
+		std::unique_lock<std::mutex> lock(lock_);
 
-	if (!d_.sqlite_query(sql, table_, error))
-		return false;
+#ifdef SQLITE_ENABLE_SNAPSHOT
+		if (idle_.empty() && snapshot_) {
+			lock.unlock();
 
-	if (!table_.empty()) {
-		for (const auto& row : table_)
-			records.push_back(row);
-		return true;
+			sqlite3* db = nullptr;
+			std::string error;
+			if (owner_.take_read_connection(db, error)) {
+				if (sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) == SQLITE_OK &&
+					sqlite3_snapshot_open(db, "main", snapshot_) == SQLITE_OK) {
+					lock.lock();
+					connections_.push_back(db);
+					return db;
+				}
+
+				sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+				owner_.return_read_connection(db);
+			}
+
+			lock.lock();
+		}
+#endif
+
+		released_.wait(lock, [this]() { return !idle_.empty(); });
+		sqlite3* db = idle_.back();
+		idle_.pop_back();
+		return db;
 	}
-	else {
-		error = "the table is empty!";
-		return false;
+
+	void release(sqlite3* db) {
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			idle_.push_back(db);
+		}
+		released_.notify_one();
+	}
+
+	// runs an hbase method with its queries on one of the session's connections
+	template <typename function>
+	bool run(function call) {
+		struct route {
+			sqlite3* db;
+			route(const void* owner, sqlite3* db) : db(db) {
+				session_owner = owner;
+				session_connection = db;
+			}
+			~route() {
+				session_owner = nullptr;
+				session_connection = nullptr;
+			}
+		};
+
+		sqlite3* db = acquire();
+		bool success = false;
+		{
+			route routed(&owner_, db);
+			success = call();
+		}
+		release(db);
+		return success;
 	}
+};
+
+hlib::hbase::read_session_::read_session_(hbase& db) :
+	d_(*new read_session_impl(db)) {}
+
+hlib::hbase::read_session_::~read_session_() {
+	delete& d_;
 }
 
+bool hlib::hbase::read_session_::count_records(const field_& field,
+	const std::string& table_name,
+	size_t& records,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.count_records(field, table_name, records, error); });
+}
 
+bool hlib::hbase::read_session_::count_records(const std::string& table_name,
+	size_t& records,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.count_records(table_name, records, error); });
+}
 
-bool hlib::hbase::custom_query(const std::string& custom_query_, std::string& error) {
+bool hlib::hbase::read_session_::get_records(table& records,
+	const std::vector<field_>& compound_keys,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.get_records(records, compound_keys, table_name, error); });
+}
 
-	if (!d_.connected_) {
-		error = "Not connected to database";
-		return false;
-	}
+bool hlib::hbase::read_session_::get_records(table& records,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.get_records(records, table_name, error); });
+}
 
-	table table_;
-	if (!d_.sqlite_query(custom_query_, table_, error))
-		return false;
+bool hlib::hbase::read_session_::get_records_with_sort_by(table& records,
+	const field_& field_sort_by,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.get_records_with_sort_by(records, field_sort_by, table_name, error); });
+}
 
-	if (!table_.empty()) 
-		return true;
-	else {
-		error = "the table is empty!";
-		return false;
-	}
+bool hlib::hbase::read_session_::get_records_with_and_sort_by(table& records,
+	const std::vector<field_>& compound_keys,
+	const field_& field_sort_by,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.run([&]() {
+		return d_.db_.get_records_with_and_sort_by(records, compound_keys, field_sort_by, table_name, error);
+		});
 }
 
-bool hlib::hbase::update_record(const field_ field,
-	std::vector<field_>& row_update,
+bool hlib::hbase::read_session_::get_records_with_or_sort_by(table& records,
+	const std::vector<field_>& compound_keys,
+	const field_& field_sort_by,
 	const std::string& table_name,
 	std::string& error) {
+	return d_.run([&]() {
+		return d_.db_.get_records_with_or_sort_by(records, compound_keys, field_sort_by, table_name, error);
+		});
+}
 
-	if (!d_.connected_) { 
-		error = "Not connected to database"; 
-		return false; 
-	}
+bool hlib::hbase::read_session_::get_records_using_custom_query(table& records,
+	const std::string& custom_query_statement,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.get_records_using_custom_query(records, custom_query_statement, error); });
+}
 
-	size_t index = 1;
-	std::string fields;
-	for (auto field_ : row_update) {
-		fields += field_.name + " = '" + field_.value + "'";
+bool hlib::hbase::read_session_::get_row_hashes(row_hashes& hashes,
+	const std::string& table_name,
+	std::string& error) {
+	return d_.run([&]() { return d_.db_.get_row_hashes(hashes, table_name, error); });
+}
 
-		if (index < row_update.size())
-			fields += ",";
-		index++;
+std::shared_ptr<hlib::hbase::read_session_> hlib::hbase::begin_read(std::string& error) {
+
+	if (!d_.connected_) {
+		error = "Not connected to database";
+		return nullptr;
 	}
 
-	table table_;
-	std::string sql = "UPDATE " + table_name + " SET ";
-	sql += fields + " WHERE " + field.name + " = '" + field.value +"';";
-;
-	if (!d_.sqlite_query(sql, table_, error)) 
-		return false;
+	// other connections cannot see an in-memory database
+	const char* filename = sqlite3_db_filename(d_.db_, "main");
+	if (!filename || !*filename) {
+		error = "Read sessions need a database file";
+		return nullptr;
+	}
 
-	return true;
+	// hot tables are read as they are in the file
+	if (!d_.flush(error))
+		return nullptr;
+
+	sqlite3* db = nullptr;
+	if (!d_.take_read_connection(db, error))
+		return nullptr;
+
+	if (!d_.begin_read(db, error)) {
+		d_.return_read_connection(db);
+		return nullptr;
+	}
+
+	std::shared_ptr<read_session_> session(new read_session_(*this));
+	session->d_.add(db);
+	return session;
 }
 
 hlib::hbase::hbase() :
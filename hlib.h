@@ -33,11 +33,19 @@
 //	permits.
 //----------------------------------------------------------------------------------
 
+#if defined(HLIB_STATIC)
+
+#define HLIB_API
+
+#elif defined(_WIN32)
+
 #ifdef _WIN64
 
 #ifdef HLIB_EXPORTS
 #define HLIB_API __declspec(dllexport)
+#ifndef HLIB_NO_AUTOLINK
 #pragma comment(lib, "sqlcipher64.lib")
+#endif
 #else
 #define HLIB_API __declspec(dllimport)
 #endif
@@ -46,25 +54,91 @@
 
 #ifdef HLIB_EXPORTS
 #define HLIB_API __declspec(dllexport)
+#ifndef HLIB_NO_AUTOLINK
 #pragma comment(lib, "sqlcipher32.lib")
+#endif
 #else
 #define HLIB_API __declspec(dllimport)
 #endif
 
 #endif // _WIN64.
 
+#elif defined(__GNUC__)
+
+// the library is built with -fvisibility=hidden, only the API is exported
+#define HLIB_API __attribute__((visibility("default")))
+
+#else
+
+#define HLIB_API
+
+#endif // HLIB_STATIC.
+
 
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <functional>
+#include <optional>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace hlib {
+	// errors of hlib itself, in hlib_category(). errors from sqlite are its
+	// result codes, in sqlite_category(). messages are only formatted when
+	// std::error_code::message() is called
+	enum class error_ {
+		not_connected = 1,
+		invalid_argument
+	};
+
+	HLIB_API const std::error_category& sqlite_category();
+	HLIB_API const std::error_category& hlib_category();
+	HLIB_API std::error_code make_error_code(error_ code);
+}
+
+namespace std {
+	template <>
+	struct is_error_code_enum<hlib::error_> : true_type {};
+}
+
+namespace hlib {
+	// every method that takes a std::string& error has a message for it when it
+	// fails. the methods that also take a std::error_code& report a code instead,
+	// which costs nothing to make. queries that find no rows succeed with no rows
 	class HLIB_API hbase {
 	public:
 
 		struct file_ {
 			std::string name;
 			std::string password;
+
+			// 64 hex digits (a 256 bit key) or 96 (key and salt), used instead of
+			// the password without running the kdf. see derive_key
+			std::string raw_key;
+
+			// sqlcipher settings, 0 keeps the default
+			int kdf_iterations = 0;
+			int cipher_page_size = 0;
+
+			// how often the rows of hot tables are written to the file
+			int hot_flush_interval_ms = 1000;
+
+			// the page cache of the connection in KiB, 0 keeps sqlite's default
+			int cache_size_kb = 0;
+
+			// lookaside memory of the connection, slots of slot_size bytes for its
+			// small short lived allocations. 0 keeps sqlite's default
+			int lookaside_slot_size = 0;
+			int lookaside_slots = 0;
+
+			// create the file with auto_vacuum = INCREMENTAL, so that maintenance
+			// can give free pages back. an existing file keeps its mode until it
+			// is vacuumed
+			bool incremental_vacuum = false;
 		};
 
 		enum class column_type_ {
@@ -83,12 +157,25 @@ namespace hlib {
 			std::string name;
 			column_type_ type = column_type_::text_;
 			constraint_ constraint = constraint_::null;
+
+			// index the column for full text search, see search()
+			bool searchable = false;
 		};
 
 		struct table_ {
 			std::string name;
 			std::vector<column_> columns;
 			std::vector<std::string> primary_key;
+
+			// keep a hash of every row in row_hash_column, see get_row_hashes
+			bool row_hash = false;
+
+			// keep the table in memory: it is loaded from the file on connect and
+			// reads and writes go to memory. changed rows are written to the file
+			// every file_::hot_flush_interval_ms, by flush() and when the hbase is
+			// destroyed, so a crash loses the changes since the last flush. hot
+			// tables cannot have row hashes or searchable columns
+			bool hot = false;
 		};
 
 		struct field_ {
@@ -101,60 +188,762 @@ namespace hlib {
 			std::vector<table_>& tables,
 			std::string& error);
 
-		bool insert_row(std::vector<field_>& row,
+		bool insert_row(const std::vector<field_>& row,
 			const std::string& table_name,
 			std::string& error);
 
+		bool insert_row(const std::vector<field_>& row,
+			const std::string& table_name,
+			std::error_code& error);
+
 		bool delete_row(const field_& field,
 			const std::string& table_name,
 			std::string& error);
 
+		bool delete_row(const field_& field,
+			const std::string& table_name,
+			std::error_code& error);
+
 		bool count_records(const field_& field,
 			const std::string& table_name,
 			size_t& records,
 			std::string& error);
 
+		bool count_records(const field_& field,
+			const std::string& table_name,
+			size_t& records,
+			std::error_code& error);
+
 		bool count_records(const std::string& table_name,
 			size_t& records,
 			std::string& error);
 
+		bool count_records(const std::string& table_name,
+			size_t& records,
+			std::error_code& error);
+
+		// the get_records methods add the rows they read to the end of records,
+		// which can be cleared and passed again to reuse its capacity. the rows
+		// are built in place, nothing is copied
 		using table = std::vector<std::map<std::string, std::string>>;
 		bool get_records(table& records,
 			const std::vector<field_>& compound_keys,
 			const std::string& table_name,
 			std::string& error);
 
+		bool get_records(table& records,
+			const std::vector<field_>& compound_keys,
+			const std::string& table_name,
+			std::error_code& error);
+
 		bool get_records_with_sort_by(table& records,
 			const field_& field_sort_by,
 			const std::string& table_name,
 			std::string& error);
 
+		bool get_records_with_sort_by(table& records,
+			const field_& field_sort_by,
+			const std::string& table_name,
+			std::error_code& error);
+
 		bool get_records_with_and_sort_by(table& records,
 			const std::vector<field_>& compound_keys,
 			const field_& field_sort_by,
 			const std::string& table_name,
 			std::string& error);
 
+		bool get_records_with_and_sort_by(table& records,
+			const std::vector<field_>& compound_keys,
+			const field_& field_sort_by,
+			const std::string& table_name,
+			std::error_code& error);
+
 		bool get_records_with_or_sort_by(table& records,
 			const std::vector<field_>& compound_keys,
 			const field_& field_sort_by,
 			const std::string& table_name,
 			std::string& error);
 
+		bool get_records_with_or_sort_by(table& records,
+			const std::vector<field_>& compound_keys,
+			const field_& field_sort_by,
+			const std::string& table_name,
+			std::error_code& error);
+
 		bool get_records(table& records,
 			const std::string& table_name,
 			std::string& error);
 
+		bool get_records(table& records,
+			const std::string& table_name,
+			std::error_code& error);
+
+		// the rows as a new table, moved out to the caller
+		table get_records(const std::vector<field_>& compound_keys,
+			const std::string& table_name,
+			std::error_code& error);
+
+		table get_records(const std::string& table_name,
+			std::error_code& error);
+
 		bool get_records_using_custom_query(table& records,
 			const std::string& custom_query_statement,
 			std::string& error);
 
+		bool get_records_using_custom_query(table& records,
+			const std::string& custom_query_statement,
+			std::error_code& error);
+
 		bool custom_query(const std::string& custom_query_, std::string& error);
-		bool update_record(const field_ field,
-			std::vector<field_>& row_update,
+		bool custom_query(const std::string& custom_query_, std::error_code& error);
+
+		bool update_record(const field_& field,
+			const std::vector<field_>& row_update,
+			const std::string& table_name,
+			std::string& error);
+
+		bool update_record(const field_& field,
+			const std::vector<field_>& row_update,
+			const std::string& table_name,
+			std::error_code& error);
+
+		// called after every backup step with the pages still to be copied
+		// and the total number of pages in the source database
+		using backup_progress = std::function<void(int remaining, int total)>;
+
+		// online backup of the database into the file at path. pages_per_step
+		// pages are copied at a time (everything at once if not positive) and the
+		// source is released between steps so writers are not held up for the whole
+		// backup. the target is keyed with the same password as the source. a
+		// source that stays busy for 30 seconds fails the backup with the busy
+		// error.
+		bool backup_to(const std::string& path,
+			int pages_per_step,
+			backup_progress progress,
+			std::string& error);
+
+		// blobs are streamed through a fixed buffer, so a large one is never in
+		// memory as a whole. a writer fills buffer with up to size bytes and
+		// returns how many it wrote, a reader gets the blob chunk by chunk and
+		// returns false to stop. the connection is held while a blob streams
+		using blob_writer = std::function<size_t(unsigned char* buffer, size_t size)>;
+		using blob_reader = std::function<bool(const unsigned char* data, size_t size)>;
+
+		// inserts row with a blob of blob_size bytes from writer in column_name.
+		// the row is only there once the whole blob is written, and subscribers
+		// see one insert however many chunks it took
+		bool insert_blob(const std::vector<field_>& row,
+			const std::string& column_name,
+			size_t blob_size,
+			blob_writer writer,
+			const std::string& table_name,
+			std::string& error);
+
+		// replaces the blob in column_name of the row matching field, which
+		// subscribers see as one update
+		bool write_blob(const field_& field,
+			const std::string& column_name,
+			size_t blob_size,
+			blob_writer writer,
+			const std::string& table_name,
+			std::string& error);
+
+		bool read_blob(const field_& field,
+			const std::string& column_name,
+			blob_reader reader,
+			const std::string& table_name,
+			std::string& error);
+
+		bool blob_size(const field_& field,
+			const std::string& column_name,
+			const std::string& table_name,
+			size_t& size,
+			std::string& error);
+
+		// timings of one statement shape, i.e. a statement with its literals
+		// replaced by ?. times are in milliseconds
+		struct query_stats_ {
+			std::string statement;
+			unsigned long long calls = 0;
+			unsigned long long errors = 0;
+			unsigned long long rows = 0;
+			unsigned long long bytes = 0;
+			double prepare_ms = 0.0;
+			double step_ms = 0.0;
+			double materialize_ms = 0.0;
+			double p50_ms = 0.0;
+			double p99_ms = 0.0;
+			double p999_ms = 0.0;
+		};
+
+		// statistics are off by default, in which case a query only pays for
+		// checking a flag
+		void enable_stats(bool enable);
+		void reset_stats();
+		std::vector<query_stats_> stats();
+
+		// called with the statement and its duration whenever a statement takes
+		// threshold_ms or longer. pass an empty callback to turn this off
+		using slow_query_callback = std::function<void(const std::string& statement, double milliseconds)>;
+		void on_slow_query(double threshold_ms,
+			slow_query_callback callback);
+
+		// the plan of a slow statement shape. full_scans are the tables read
+		// without an index, temp_b_tree is set when the rows are sorted for an
+		// ORDER BY or GROUP BY. calls and total_ms count the slow calls only
+		struct query_plan_ {
+			std::string statement;
+			std::string plan;
+			std::vector<std::string> full_scans;
+			bool temp_b_tree = false;
+			unsigned long long calls = 0;
+			double total_ms = 0.0;
+		};
+
+		// an index that would serve slow statements, with the plans it helps
+		struct index_advice_ {
+			std::string table_name;
+			std::vector<std::string> columns;
+			std::string create_statement;
+			unsigned long long calls = 0;
+			unsigned long long full_scans = 0;
+			unsigned long long temp_b_trees = 0;
+			double total_ms = 0.0;
+			std::vector<std::string> statements;
+		};
+
+		// statements that take threshold_ms or longer are run through EXPLAIN
+		// QUERY PLAN, once per statement shape. off by default, a negative
+		// threshold turns it off again
+		void capture_plans(double threshold_ms);
+		void reset_plans();
+		std::vector<query_plan_> query_plans();
+
+		// CREATE INDEX statements for the captured plans, from the columns the
+		// statements filter and sort on, most expensive first. indexes the table
+		// already has are left out
+		std::vector<index_advice_> index_advice();
+
+		// the advice and the captured plans as text
+		std::string index_report();
+
+		// workload capture: every statement the connection runs is written to a
+		// compact binary trace with its values, duration, row count and thread,
+		// for hlib_replay. with hash_values only a hash of each value is kept,
+		// and the trace replays with NULL for them. destroying the hbase stops it
+		bool start_capture(const std::string& path,
+			bool hash_values,
+			std::string& error);
+
+		void stop_capture();
+
+		struct trace_value_ {
+			enum class kind_ {
+				text,
+				number,
+				hash
+			};
+
+			kind_ kind = kind_::text;
+			std::string value;
+		};
+
+		// an operation of a trace. the values are those of the statement's
+		// literals, which are ? in the statement, or bound to its parameters.
+		// times are from the start of the capture
+		struct trace_record_ {
+			std::string statement;
+			std::vector<trace_value_> values;
+			bool bound = false;
+			bool success = true;
+			unsigned thread = 0;
+			long long start_ns = 0;
+			long long duration_ns = 0;
+			unsigned long long rows = 0;
+		};
+
+		static bool read_trace(const std::string& path,
+			std::vector<trace_record_>& records,
+			std::string& error);
+
+		// the statement of a record with its values put back
+		static std::string replay_statement(const trace_record_& record);
+
+		// rows of the table matching an fts5 query (e.g. "error AND disk*") in
+		// its searchable columns, best matches first. a limit of 0 returns all
+		bool search(table& records,
+			const std::string& table_name,
+			const std::string& query,
+			size_t limit,
+			std::string& error);
+
+		// pbkdf2-hmac-sha256 of password and salt, as 64 hex digits for
+		// file_::raw_key. derived keys are cached for the life of the process, so
+		// only the first open of a database pays for the iterations
+		static std::string derive_key(const std::string& password,
+			const std::string& salt,
+			int iterations);
+
+		// row hashes are the first 128 bits (as hex) of the sha-256 of the row's
+		// column values. insert_row, update_record and the blob writers keep them
+		// up to date; rows inserted without hlib are hashed when the hashes are
+		// read, rows updated without it keep their old hash
+		static const std::string row_hash_column;
+
+		// primary key values -> row hash
+		using row_hashes = std::map<std::vector<std::string>, std::string>;
+		bool get_row_hashes(row_hashes& hashes,
+			const std::string& table_name,
+			std::string& error);
+
+		// primary keys of the rows that differ between two tables, which may be in
+		// this database (pass *this as other) or in another one. added rows are
+		// only in the other table, removed rows are only in this one
+		struct row_diff_ {
+			std::vector<std::vector<std::string>> added;
+			std::vector<std::vector<std::string>> removed;
+			std::vector<std::vector<std::string>> changed;
+		};
+
+		bool diff_table(row_diff_& diff,
+			const std::string& table_name,
+			hbase& other,
+			const std::string& other_table_name,
+			std::string& error);
+
+		enum class aggregate_function_ {
+			count_,
+			sum_,
+			avg_,
+			min_,
+			max_
+		};
+
+		// an empty column counts rows, i.e. COUNT(*)
+		struct aggregate_ {
+			aggregate_function_ function = aggregate_function_::count_;
+			std::string column;
+		};
+
+		// null is set when there was nothing to aggregate, e.g. the sum of a
+		// group where the column is always NULL. otherwise both members hold
+		// the value, integer truncated for averages and floating point columns
+		struct aggregate_value_ {
+			bool null = true;
+			long long integer = 0;
+			double real = 0.0;
+		};
+
+		struct aggregate_row_ {
+			std::vector<std::string> group;
+			std::vector<aggregate_value_> values;
+		};
+
+		// computes the aggregates inside sqlite over the rows matching all the
+		// filters, one row per distinct value of the group_by columns (in that
+		// order) or a single row if there are none. group holds the values of the
+		// group_by columns and values one entry per aggregate
+		bool aggregate(std::vector<aggregate_row_>& result,
+			const std::vector<aggregate_>& aggregates,
+			const std::vector<std::string>& group_by,
+			const std::vector<field_>& filters,
+			const std::string& table_name,
+			std::string& error);
+
+		bool aggregate(std::vector<aggregate_row_>& result,
+			const std::vector<aggregate_>& aggregates,
+			const std::vector<std::string>& group_by,
+			const std::vector<field_>& filters,
+			const std::string& table_name,
+			std::error_code& error);
+
+		enum class change_operation_ {
+			insert_,
+			update_,
+			delete_
+		};
+
+		// a row that was changed, by rowid and by the values of its primary key
+		// (in the order of table_::primary_key). for a deleted row they are those
+		// it had, and an update that changes the key is a delete of the old row
+		// and an insert of the new one. the key is only known when sqlite was
+		// built with SQLITE_ENABLE_PREUPDATE_HOOK, which the cmake build detects
+		struct change_ {
+			change_operation_ operation = change_operation_::insert_;
+			std::string table_name;
+			long long rowid = 0;
+			std::vector<std::string> key;
+		};
+
+		// called with the changes of one transaction, in order, once it has
+		// committed; nothing is called for a transaction that rolls back.
+		// callbacks run on a delivery thread of their own and must not block it
+		using change_callback = std::function<void(const std::vector<change_>& changes)>;
+
+		// subscription identifies the callback for unsubscribe. changes are only
+		// recorded while there is at least one subscriber
+		bool subscribe(change_callback callback,
+			int& subscription,
+			std::string& error);
+
+		void unsubscribe(int subscription);
+
+		struct scan_options_ {
+			// 0 uses one thread per core
+			size_t threads = 0;
+
+			// rows per chunk, about
+			size_t chunk_rows = 10000;
+
+			// deliver the chunks in rowid order, otherwise as they are read
+			bool ordered = true;
+		};
+
+		// called with the chunk's number (its place in rowid order) and its rows,
+		// which it may move from. calls do not overlap. return false to stop
+		using scan_callback = std::function<bool(size_t chunk, table& rows)>;
+
+		// reads the whole table in rowid ranges on several threads, each with a
+		// read only connection of its own, taken from the pool read sessions
+		// use, so the chunks do not come from one snapshot if the table is
+		// written to meanwhile. in-memory databases are read on the calling
+		// thread
+		bool parallel_scan(const std::string& table_name,
+			const scan_options_& options,
+			scan_callback callback,
+			std::string& error);
+
+		// get_records using parallel_scan, the rows are in rowid order
+		bool get_records(table& records,
 			const std::string& table_name,
+			const scan_options_& options,
 			std::string& error);
 
+		// the database, or only the given tables (with their rows, but without
+		// indexes or triggers), as one image in the sqlite file format. an image
+		// is not encrypted. it can be opened with connect() below, and an image
+		// written by serialize_to is also a database file connect(file_) can open
+		bool serialize(std::vector<unsigned char>& image,
+			const std::vector<std::string>& table_names,
+			std::string& error);
+
+		bool serialize_to(const std::string& path,
+			const std::vector<std::string>& table_names,
+			std::string& error);
+
+		// connects to an image made by serialize. it is opened in place, with
+		// no parsing of rows. if copy is false sqlite reads the image where it is,
+		// e.g. a mapped file, which must then outlive the hbase, and the database
+		// is read only. if copy is true it works on a copy that can be written to
+		bool connect(const unsigned char* image,
+			size_t size,
+			bool copy,
+			std::string& error);
+
+		enum class checkpoint_mode_ {
+			passive,
+			restart,
+			truncate
+		};
+
+		struct checkpoint_policy_ {
+			// checkpoint once the wal has this many pages
+			long long wal_pages = 1000;
+
+			// or when there were no commits for this long
+			int idle_ms = 1000;
+
+			// how often the wal is looked at
+			int poll_interval_ms = 100;
+
+			// passive never waits for readers or writers. restart and truncate
+			// also start the wal over (truncate to zero bytes) if they can
+			checkpoint_mode_ mode = checkpoint_mode_::passive;
+		};
+
+		struct checkpoint_stats_ {
+			unsigned long long checkpoints = 0;
+
+			// checkpoints that could not run because the database was busy
+			unsigned long long busy = 0;
+			unsigned long long pages_checkpointed = 0;
+
+			// the wal after the last checkpoint
+			long long wal_pages = 0;
+			unsigned long long wal_bytes = 0;
+
+			double last_ms = 0.0;
+			double max_ms = 0.0;
+			double total_ms = 0.0;
+		};
+
+		// turns off sqlite's automatic checkpoints, which run inside whichever
+		// commit fills the wal, and runs them on a thread with a connection of
+		// its own instead. the database must be in wal mode
+		bool start_checkpoints(const checkpoint_policy_& policy,
+			std::string& error);
+
+		// back to automatic checkpoints. also done when the hbase is destroyed
+		void stop_checkpoints();
+
+		checkpoint_stats_ checkpoint_stats();
+
+		// lets sqlite's planner treat a registered function like a built in one.
+		// deterministic functions give the same result for the same arguments and
+		// can be used in indexes, innocuous ones have no side effects. direct_only
+		// functions cannot be called from triggers and views. all are off by
+		// default, as in sqlite: sqlite may call a deterministic function once
+		// for a statement, so one that reads the clock, a random source or
+		// changing state must not be marked
+		struct function_flags_ {
+			bool deterministic = false;
+			bool innocuous = false;
+			bool direct_only = false;
+		};
+
+		// the arguments of a call to a registered function
+		class HLIB_API function_arguments_ {
+		public:
+			function_arguments_(void** values, int count);
+
+			int count() const;
+			bool is_null(int index) const;
+			long long integer(int index) const;
+			double real(int index) const;
+			std::string text(int index) const;
+			std::vector<unsigned char> blob(int index) const;
+		private:
+			void** values_;
+			int count_;
+		};
+
+		// the result of a call to a registered function, NULL if nothing is set
+		class HLIB_API function_result_ {
+		public:
+			explicit function_result_(void* context);
+
+			void null();
+			void integer(long long value);
+			void real(double value);
+			void text(const std::string& value);
+			void blob(const std::vector<unsigned char>& value);
+
+			// fails the statement with message
+			void error(const std::string& message);
+		private:
+			void* context_;
+		};
+
+		using scalar_function = std::function<void(const function_arguments_& arguments, function_result_& result)>;
+
+		// an aggregate keeps a state per group, made by create and freed by
+		// destroy. step adds a row to the state and result reads it. with inverse,
+		// which takes a row out of the state again, it is also a window function
+		struct aggregate_callbacks_ {
+			std::function<void* ()> create;
+			std::function<void(void* state)> destroy;
+			std::function<void(void* state, const function_arguments_& arguments)> step;
+			std::function<void(void* state, const function_arguments_& arguments)> inverse;
+			std::function<void(void* state, function_result_& result)> result;
+		};
+
+		// registers a function with the connection, and with the read only
+		// connections of read sessions and scans started after it, for use in
+		// any query. a function with the name and number of arguments (-1 for
+		// any number) of an earlier one replaces it. an exception thrown by the
+		// function fails the statement with its message
+		bool create_function(const std::string& name,
+			int arguments,
+			const function_flags_& flags,
+			scalar_function function,
+			std::string& error);
+
+		bool create_aggregate(const std::string& name,
+			int arguments,
+			const function_flags_& flags,
+			const aggregate_callbacks_& callbacks,
+			std::string& error);
+
+		// the same with typed arguments and result: bool, integers, floating
+		// point, std::string, std::vector<unsigned char> (blobs) and std::optional
+		// of these for NULL. e.g.
+		//   db.create_function("net", [](double price, double tax) { return price / (1 + tax); }, { true }, error);
+		template <typename callable>
+		bool create_function(const std::string& name,
+			callable function,
+			const function_flags_& flags,
+			std::string& error);
+
+		// an aggregate (or window function) from a class with a step() method
+		// taking the typed arguments, a result() method and, for a window
+		// function, an inverse() method like step(). e.g.
+		//   struct total { long long sum = 0; void step(long long v) { sum += v; } long long result() { return sum; } };
+		//   db.create_aggregate<total>("total", {}, error);
+		template <typename state>
+		bool create_aggregate(const std::string& name,
+			const function_flags_& flags,
+			std::string& error);
+
+		struct maintenance_policy_ {
+			// PRAGMA optimize this often, 0 for never, and when maintenance stops
+			int optimize_interval_ms = 60 * 60 * 1000;
+			bool optimize_on_close = true;
+
+			// once no rows were changed for idle_ms, free pages are given back to
+			// the file system vacuum_pages at a time. only for files with
+			// incremental vacuum
+			int vacuum_pages = 100;
+			int idle_ms = 5000;
+
+			int poll_interval_ms = 1000;
+		};
+
+		struct maintenance_stats_ {
+			unsigned long long optimizes = 0;
+			unsigned long long vacuums = 0;
+			unsigned long long pages_vacuumed = 0;
+
+			long long page_size = 0;
+			long long page_count = 0;
+			long long freelist_pages = 0;
+			bool incremental_vacuum = false;
+
+			// the share of the file in free pages, and in free pages and the free
+			// space inside used pages. the latter reads every page, and is the
+			// freelist ratio where sqlite has no dbstat table
+			double freelist_ratio = 0.0;
+			double fragmentation = 0.0;
+		};
+
+		// runs PRAGMA optimize and incremental vacuum on a background thread, on
+		// this connection and never inside an open transaction
+		bool start_maintenance(const maintenance_policy_& policy,
+			std::string& error);
+
+		// also done when the hbase is destroyed
+		void stop_maintenance();
+
+		// the same by hand
+		bool optimize(std::string& error);
+		bool incremental_vacuum(int pages,
+			std::string& error);
+
+		bool maintenance_stats(maintenance_stats_& stats,
+			std::string& error);
+
+		// process wide memory settings for sqlite. the pooled allocator serves
+		// sqlite's heap from pools of freed blocks in size classes instead of
+		// malloc, and can only be installed before the first connection. past the
+		// soft limit sqlite frees cache pages before it allocates, past the hard
+		// limit allocations fail with SQLITE_NOMEM. 0 turns a limit off
+		struct memory_config_ {
+			bool pooled_allocator = false;
+
+			// free blocks kept in the pools, the rest goes back to malloc
+			size_t pool_limit_bytes = 16 * 1024 * 1024;
+
+			long long soft_heap_limit_bytes = 0;
+			long long hard_heap_limit_bytes = 0;
+		};
+
+		static bool configure_memory(const memory_config_& config,
+			std::string& error);
+
+		struct memory_report_ {
+			// this connection
+			long long page_cache_bytes = 0;
+			long long schema_bytes = 0;
+			long long statement_bytes = 0;
+			long long lookaside_slots_used = 0;
+			long long lookaside_hits = 0;
+			long long lookaside_misses = 0;
+
+			// an estimate of what the rows read by the last query of this hbase
+			// take in memory, and the most any of its queries took
+			unsigned long long result_bytes = 0;
+			unsigned long long result_bytes_peak = 0;
+
+			// the whole process
+			long long sqlite_heap_bytes = 0;
+			long long sqlite_heap_peak = 0;
+			unsigned long long pooled_bytes = 0;
+		};
+
+		memory_report_ memory_report();
+
+		// a read transaction pinned on read only connections of its own for the
+		// life of the session, so that all its queries see the same data and the
+		// read lock is only taken once. hot tables are flushed when it begins.
+		// several threads can use a session; in wal mode, where sqlite was
+		// built with SQLITE_ENABLE_SNAPSHOT (which the cmake build detects), each
+		// gets a connection opened on the session's snapshot, otherwise they
+		// take turns on one connection. a session must end before its hbase is
+		// destroyed
+		class HLIB_API read_session_ {
+		public:
+			bool count_records(const field_& field,
+				const std::string& table_name,
+				size_t& records,
+				std::string& error);
+
+			bool count_records(const std::string& table_name,
+				size_t& records,
+				std::string& error);
+
+			bool get_records(table& records,
+				const std::vector<field_>& compound_keys,
+				const std::string& table_name,
+				std::string& error);
+
+			bool get_records(table& records,
+				const std::string& table_name,
+				std::string& error);
+
+			bool get_records_with_sort_by(table& records,
+				const field_& field_sort_by,
+				const std::string& table_name,
+				std::string& error);
+
+			bool get_records_with_and_sort_by(table& records,
+				const std::vector<field_>& compound_keys,
+				const field_& field_sort_by,
+				const std::string& table_name,
+				std::string& error);
+
+			bool get_records_with_or_sort_by(table& records,
+				const std::vector<field_>& compound_keys,
+				const field_& field_sort_by,
+				const std::string& table_name,
+				std::string& error);
+
+			bool get_records_using_custom_query(table& records,
+				const std::string& custom_query_statement,
+				std::string& error);
+
+			bool get_row_hashes(row_hashes& hashes,
+				const std::string& table_name,
+				std::string& error);
+
+			~read_session_();
+
+			read_session_(read_session_&) = delete;
+			read_session_ operator=(read_session_&) = delete;
+		private:
+			friend class hbase;
+			read_session_(hbase& db);
+
+			class read_session_impl;
+			read_session_impl& d_;
+		};
+
+		// in rollback journal mode writers cannot commit while a session is open,
+		// in wal mode they carry on. nullptr on failure
+		std::shared_ptr<read_session_> begin_read(std::string& error);
+
+		// writes the changed rows of hot tables to the file now. nothing is
+		// written while a transaction is open on the connection
+		bool flush(std::string& error);
+
 		hbase();
 		~hbase();
 
@@ -164,4 +953,212 @@ namespace hlib {
 		class hbase_impl;
 		hbase_impl& d_;
 	};
+
+	// the typed arguments and results of registered functions
+	namespace detail {
+		template <typename type>
+		struct function_traits : function_traits<decltype(&type::operator())> {};
+
+		template <typename result_type, typename... argument_types>
+		struct function_traits<result_type(*)(argument_types...)> {
+			using arguments = std::tuple<std::decay_t<argument_types>...>;
+		};
+
+		template <typename result_type, typename class_type, typename... argument_types>
+		struct function_traits<result_type(class_type::*)(argument_types...)> {
+			using arguments = std::tuple<std::decay_t<argument_types>...>;
+		};
+
+		template <typename result_type, typename class_type, typename... argument_types>
+		struct function_traits<result_type(class_type::*)(argument_types...) const> {
+			using arguments = std::tuple<std::decay_t<argument_types>...>;
+		};
+
+		template <typename type>
+		struct is_optional : std::false_type {};
+
+		template <typename type>
+		struct is_optional<std::optional<type>> : std::true_type {};
+
+		template <typename type, typename = void>
+		struct has_inverse : std::false_type {};
+
+		template <typename type>
+		struct has_inverse<type, std::void_t<decltype(&type::inverse)>> : std::true_type {};
+
+		template <typename type>
+		type argument(const hbase::function_arguments_& arguments, int index) {
+			if constexpr (is_optional<type>::value) {
+				if (arguments.is_null(index))
+					return std::nullopt;
+				return argument<typename type::value_type>(arguments, index);
+			}
+			else
+				if constexpr (std::is_same_v<type, bool>)
+					return arguments.integer(index) != 0;
+				else
+					if constexpr (std::is_integral_v<type>)
+						return static_cast<type>(arguments.integer(index));
+					else
+						if constexpr (std::is_floating_point_v<type>)
+							return static_cast<type>(arguments.real(index));
+						else
+							if constexpr (std::is_same_v<type, std::string>)
+								return arguments.text(index);
+							else {
+								static_assert(std::is_same_v<type, std::vector<unsigned char>>, "unsupported argument type");
+								return arguments.blob(index);
+							}
+		}
+
+		template <typename tuple, size_t... index>
+		tuple arguments(const hbase::function_arguments_& values, std::index_sequence<index...>) {
+			return tuple{ argument<std::tuple_element_t<index, tuple>>(values, static_cast<int>(index))... };
+		}
+
+		template <typename type>
+		void set_result(hbase::function_result_& result, const type& value) {
+			if constexpr (is_optional<type>::value) {
+				if (value)
+					set_result(result, *value);
+				else
+					result.null();
+			}
+			else
+				if constexpr (std::is_integral_v<type>)
+					result.integer(static_cast<long long>(value));
+				else
+					if constexpr (std::is_floating_point_v<type>)
+						result.real(static_cast<double>(value));
+					else
+						if constexpr (std::is_convertible_v<type, std::string>)
+							result.text(value);
+						else {
+							static_assert(std::is_same_v<type, std::vector<unsigned char>>, "unsupported result type");
+							result.blob(value);
+						}
+		}
+
+		// calls a member function with the unpacked arguments
+		template <typename state, typename method>
+		void call(state& object, method member, const hbase::function_arguments_& values) {
+			using tuple = typename function_traits<method>::arguments;
+			std::apply([&object, member](auto&&... arguments) {
+				(object.*member)(std::forward<decltype(arguments)>(arguments)...);
+				}, detail::arguments<tuple>(values, std::make_index_sequence<std::tuple_size_v<tuple>>()));
+		}
+	}
+
+	template <typename callable>
+	bool hbase::create_function(const std::string& name,
+		callable function,
+		const function_flags_& flags,
+		std::string& error) {
+		using tuple = typename detail::function_traits<callable>::arguments;
+		constexpr size_t count = std::tuple_size_v<tuple>;
+
+		return create_function(name, static_cast<int>(count), flags,
+			[function](const function_arguments_& values, function_result_& result) {
+				detail::set_result(result, std::apply(function,
+					detail::arguments<tuple>(values, std::make_index_sequence<count>())));
+			}, error);
+	}
+
+	template <typename state>
+	bool hbase::create_aggregate(const std::string& name,
+		const function_flags_& flags,
+		std::string& error) {
+		using tuple = typename detail::function_traits<decltype(&state::step)>::arguments;
+
+		aggregate_callbacks_ callbacks;
+		callbacks.create = []() -> void* { return new state(); };
+		callbacks.destroy = [](void* object) { delete static_cast<state*>(object); };
+		callbacks.step = [](void* object, const function_arguments_& values) {
+			detail::call(*static_cast<state*>(object), &state::step, values);
+		};
+		if constexpr (detail::has_inverse<state>::value)
+			callbacks.inverse = [](void* object, const function_arguments_& values) {
+				detail::call(*static_cast<state*>(object), &state::inverse, values);
+			};
+		callbacks.result = [](void* object, function_result_& result) {
+			detail::set_result(result, static_cast<state*>(object)->result());
+		};
+
+		return create_aggregate(name, static_cast<int>(std::tuple_size_v<tuple>), flags, callbacks, error);
+	}
+
+	// the hbase api over several database files (shards), which can be written
+	// to at the same time. every shard has every table, and a row lives in the
+	// shard picked by hashing the values of its table's primary key. operations
+	// that name the whole primary key go to one shard, everything else runs on
+	// all the shards in parallel and the results are combined
+	class HLIB_API hbase_sharded {
+	public:
+		using file_ = hbase::file_;
+		using table_ = hbase::table_;
+		using field_ = hbase::field_;
+		using table = hbase::table;
+
+		// one file per shard. the number and order of the files decides where
+		// rows go, so it must not change once there is data in them
+		bool connect(const std::vector<file_>& files,
+			std::vector<table_>& tables,
+			std::string& error);
+
+		size_t shard_count() const;
+
+		bool insert_row(const std::vector<field_>& row,
+			const std::string& table_name,
+			std::string& error);
+
+		// inserts the rows of every shard in one transaction, all shards at once
+		bool insert_rows(const std::vector<std::vector<field_>>& rows,
+			const std::string& table_name,
+			std::string& error);
+
+		bool delete_row(const field_& field,
+			const std::string& table_name,
+			std::string& error);
+
+		bool count_records(const field_& field,
+			const std::string& table_name,
+			size_t& records,
+			std::string& error);
+
+		bool count_records(const std::string& table_name,
+			size_t& records,
+			std::string& error);
+
+		bool get_records(table& records,
+			const std::vector<field_>& compound_keys,
+			const std::string& table_name,
+			std::string& error);
+
+		bool get_records(table& records,
+			const std::string& table_name,
+			std::string& error);
+
+		// every shard sorts its rows and the results are merged, comparing
+		// integer and float columns as numbers
+		bool get_records_with_sort_by(table& records,
+			const field_& field_sort_by,
+			const std::string& table_name,
+			std::string& error);
+
+		// primary key columns cannot be updated, since that could move the row
+		// to another shard
+		bool update_record(const field_& field,
+			const std::vector<field_>& row_update,
+			const std::string& table_name,
+			std::string& error);
+
+		hbase_sharded();
+		~hbase_sharded();
+
+		hbase_sharded(hbase_sharded&) = delete;
+		hbase_sharded operator=(hbase_sharded&) = delete;
+	private:
+		class hbase_sharded_impl;
+		hbase_sharded_impl& d_;
+	};
 };
\ No newline at end of file
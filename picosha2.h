@@ -34,14 +34,36 @@ THE SOFTWARE.
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <sstream>
+#include <string>
 #include <vector>
 
+// hardware acceleration (sha-ni and avx2) is picked at run time on x86;
+// define PICOSHA2_NO_SIMD to always use the portable code
+#if !defined(PICOSHA2_NO_SIMD) &&                                    \
+    (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+     defined(_M_IX86))
+#define PICOSHA2_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PICOSHA2_TARGET(features)
+#else
+#include <cpuid.h>
+#define PICOSHA2_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
 namespace picosha2 {
 typedef unsigned long word_t;
 typedef unsigned char byte_t;
 
+// compression backends, see hash256_backend()
+enum class backend_t { scalar, sha_ni, avx2 };
+
 namespace detail {
 inline byte_t mask_8bit(byte_t x) { return x & 0xff; }
 
@@ -139,8 +161,380 @@ void hash256_block(RaIter1 message_digest, RaIter2 first, RaIter2 last) {
     }
 }
 
+// compresses blocks consecutive 64 byte blocks into state
+typedef void (*compress_t)(std::uint32_t* state, const byte_t* data,
+                           std::size_t blocks);
+
+inline void compress_scalar(std::uint32_t* state, const byte_t* data,
+                            std::size_t blocks) {
+    word_t message_digest[8];
+    std::copy(state, state + 8, message_digest);
+    for (std::size_t i = 0; i < blocks; ++i) {
+        hash256_block(message_digest, data + i * 64, data + i * 64 + 64);
+    }
+    for (std::size_t i = 0; i < 8; ++i) {
+        state[i] = static_cast<std::uint32_t>(message_digest[i]);
+    }
+}
+
+inline const std::uint32_t* add_constant_32() {
+    struct table {
+        std::uint32_t k[64];
+        table() {
+            for (std::size_t i = 0; i < 64; ++i) {
+                k[i] = static_cast<std::uint32_t>(add_constant[i]);
+            }
+        }
+    };
+    static const table constants;
+    return constants.k;
+}
+
+inline std::uint32_t load_be32(const byte_t* p) {
+    return (static_cast<std::uint32_t>(p[0]) << 24) |
+           (static_cast<std::uint32_t>(p[1]) << 16) |
+           (static_cast<std::uint32_t>(p[2]) << 8) |
+           static_cast<std::uint32_t>(p[3]);
+}
+
+inline void store_be32(std::uint32_t x, byte_t* p) {
+    p[0] = static_cast<byte_t>(x >> 24);
+    p[1] = static_cast<byte_t>(x >> 16);
+    p[2] = static_cast<byte_t>(x >> 8);
+    p[3] = static_cast<byte_t>(x);
+}
+
+// the final one or two blocks of a message: the bytes after the last full
+// block, the 0x80 terminator and the message length in bits
+inline std::size_t make_tail(const byte_t* message, std::size_t size,
+                             byte_t* tail /* 128 bytes */) {
+    const std::size_t remains = size % 64;
+    std::memset(tail, 0, 128);
+    if (remains) {
+        std::memcpy(tail, message + size - remains, remains);
+    }
+    tail[remains] = 0x80;
+
+    const std::size_t blocks = remains > 55 ? 2 : 1;
+    const std::uint64_t bits = static_cast<std::uint64_t>(size) * 8;
+    byte_t* length = tail + blocks * 64 - 8;
+    store_be32(static_cast<std::uint32_t>(bits >> 32), length);
+    store_be32(static_cast<std::uint32_t>(bits), length + 4);
+    return blocks;
+}
+
+#ifdef PICOSHA2_X86
+
+inline void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) regs[i] = static_cast<unsigned int>(info[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline bool cpu_has_sha_ni() {
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7) return false;
+    cpuid(1, 0, regs);
+    const bool ssse3 = (regs[2] >> 9) & 1, sse41 = (regs[2] >> 19) & 1;
+    cpuid(7, 0, regs);
+    return ssse3 && sse41 && ((regs[1] >> 29) & 1);
+}
+
+inline bool cpu_has_avx2() {
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7) return false;
+    cpuid(1, 0, regs);
+    const bool osxsave = (regs[2] >> 27) & 1, avx = (regs[2] >> 28) & 1;
+    if (!osxsave || !avx) return false;
+
+    // the os has to save the ymm registers
+#if defined(_MSC_VER)
+    const unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    const unsigned long long xcr0 =
+        (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+    if ((xcr0 & 6) != 6) return false;
+
+    cpuid(7, 0, regs);
+    return (regs[1] >> 5) & 1;
+}
+
+// sha-ni, following the intel sha extensions reference code
+PICOSHA2_TARGET("sha,sse4.1,ssse3")
+inline void compress_sha_ni(std::uint32_t* state, const byte_t* data,
+                            std::size_t blocks) {
+    const std::uint32_t* k = add_constant_32();
+    const __m128i mask =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i state1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);                // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);          // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+
+    for (; blocks; --blocks, data += 64) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+
+        __m128i msg[4];
+        for (int i = 0; i < 4; ++i) {
+            msg[i] = _mm_shuffle_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)),
+                mask);
+        }
+
+        // 16 groups of 4 rounds; msg[g & 3] holds the words of group g
+        for (int g = 0; g < 16; ++g) {
+            __m128i m = _mm_add_epi32(
+                msg[g & 3],
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(k + 4 * g)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+            if (g >= 3 && g <= 14) {
+                tmp = _mm_alignr_epi8(msg[g & 3], msg[(g + 3) & 3], 4);
+                msg[(g + 1) & 3] = _mm_add_epi32(msg[(g + 1) & 3], tmp);
+                msg[(g + 1) & 3] =
+                    _mm_sha256msg2_epu32(msg[(g + 1) & 3], msg[g & 3]);
+            }
+            m = _mm_shuffle_epi32(m, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+            if (g >= 1 && g <= 12) {
+                msg[(g + 3) & 3] =
+                    _mm_sha256msg1_epu32(msg[(g + 3) & 3], msg[g & 3]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // ABEF
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+// eight messages at once, one in every 32 bit lane of the avx2 registers.
+// lanes without a message have a size of 0 and a null digest
+PICOSHA2_TARGET("avx2")
+inline void hash256_x8(const byte_t* const* messages, const std::size_t* sizes,
+                       byte_t (*const* digests)[32]) {
+    const std::uint32_t* k = add_constant_32();
+
+    byte_t tails[8][128];
+    std::size_t full_blocks[8], total_blocks[8], max_blocks = 0;
+    std::uint32_t active[8];
+    for (int lane = 0; lane < 8; ++lane) {
+        full_blocks[lane] = sizes[lane] / 64;
+        total_blocks[lane] = full_blocks[lane] +
+                             make_tail(messages[lane], sizes[lane], tails[lane]);
+        max_blocks = std::max(max_blocks, total_blocks[lane]);
+    }
+
+    __m256i s[8];
+    for (int i = 0; i < 8; ++i) {
+        s[i] = _mm256_set1_epi32(
+            static_cast<int>(static_cast<std::uint32_t>(initial_message_digest[i])));
+    }
+
+#define PICOSHA2_ROTR(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n))
+
+    for (std::size_t block = 0; block < max_blocks; ++block) {
+        const byte_t* data[8];
+        for (int lane = 0; lane < 8; ++lane) {
+            if (block < full_blocks[lane]) {
+                data[lane] = messages[lane] + block * 64;
+            } else if (block < total_blocks[lane]) {
+                data[lane] = tails[lane] + (block - full_blocks[lane]) * 64;
+            } else {
+                data[lane] = tails[lane];  // finished, the result is masked out
+            }
+            active[lane] = block < total_blocks[lane] ? 0xFFFFFFFFu : 0u;
+        }
+
+        __m256i w[16];
+        for (int t = 0; t < 16; ++t) {
+            w[t] = _mm256_setr_epi32(
+                static_cast<int>(load_be32(data[0] + 4 * t)),
+                static_cast<int>(load_be32(data[1] + 4 * t)),
+                static_cast<int>(load_be32(data[2] + 4 * t)),
+                static_cast<int>(load_be32(data[3] + 4 * t)),
+                static_cast<int>(load_be32(data[4] + 4 * t)),
+                static_cast<int>(load_be32(data[5] + 4 * t)),
+                static_cast<int>(load_be32(data[6] + 4 * t)),
+                static_cast<int>(load_be32(data[7] + 4 * t)));
+        }
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+        __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+        for (int t = 0; t < 64; ++t) {
+            if (t >= 16) {
+                const __m256i w2 = w[(t - 2) & 15], w15 = w[(t - 15) & 15];
+                const __m256i ssig1 = _mm256_xor_si256(
+                    _mm256_xor_si256(PICOSHA2_ROTR(w2, 17), PICOSHA2_ROTR(w2, 19)),
+                    _mm256_srli_epi32(w2, 10));
+                const __m256i ssig0 = _mm256_xor_si256(
+                    _mm256_xor_si256(PICOSHA2_ROTR(w15, 7), PICOSHA2_ROTR(w15, 18)),
+                    _mm256_srli_epi32(w15, 3));
+                w[t & 15] = _mm256_add_epi32(
+                    _mm256_add_epi32(ssig1, w[(t - 7) & 15]),
+                    _mm256_add_epi32(ssig0, w[t & 15]));
+            }
+
+            const __m256i bsig1 = _mm256_xor_si256(
+                _mm256_xor_si256(PICOSHA2_ROTR(e, 6), PICOSHA2_ROTR(e, 11)),
+                PICOSHA2_ROTR(e, 25));
+            const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                                _mm256_andnot_si256(e, g));
+            const __m256i temp1 = _mm256_add_epi32(
+                _mm256_add_epi32(_mm256_add_epi32(h, bsig1), ch),
+                _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(k[t])),
+                                 w[t & 15]));
+            const __m256i bsig0 = _mm256_xor_si256(
+                _mm256_xor_si256(PICOSHA2_ROTR(a, 2), PICOSHA2_ROTR(a, 13)),
+                PICOSHA2_ROTR(a, 22));
+            const __m256i maj = _mm256_xor_si256(
+                _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+                _mm256_and_si256(b, c));
+            const __m256i temp2 = _mm256_add_epi32(bsig0, maj);
+
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, temp1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(temp1, temp2);
+        }
+
+        const __m256i mask = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(active));
+        const __m256i result[8] = {a, b, c, d, e, f, g, h};
+        for (int i = 0; i < 8; ++i) {
+            s[i] = _mm256_blendv_epi8(s[i], _mm256_add_epi32(s[i], result[i]),
+                                      mask);
+        }
+    }
+
+#undef PICOSHA2_ROTR
+
+    std::uint32_t words[8][8];
+    for (int i = 0; i < 8; ++i) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words[i]), s[i]);
+    }
+    for (int lane = 0; lane < 8; ++lane) {
+        if (digests[lane]) {
+            for (int i = 0; i < 8; ++i) {
+                store_be32(words[i][lane], *digests[lane] + 4 * i);
+            }
+        }
+    }
+}
+
+#endif  // PICOSHA2_X86
+
+struct dispatch_t {
+    backend_t backend;
+    compress_t compress;
+};
+
+inline bool backend_supported(backend_t backend) {
+    switch (backend) {
+#ifdef PICOSHA2_X86
+        case backend_t::sha_ni:
+            return cpu_has_sha_ni();
+        case backend_t::avx2:
+            return cpu_has_avx2();
+#endif
+        case backend_t::scalar:
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline dispatch_t make_dispatch(backend_t backend) {
+    dispatch_t dispatch = {backend, &compress_scalar};
+#ifdef PICOSHA2_X86
+    // avx2 only speeds up batches, single messages use the scalar code
+    if (backend == backend_t::sha_ni) dispatch.compress = &compress_sha_ni;
+#endif
+    return dispatch;
+}
+
+inline dispatch_t& dispatch() {
+    static dispatch_t dispatch = make_dispatch(
+        backend_supported(backend_t::sha_ni)
+            ? backend_t::sha_ni
+            : backend_supported(backend_t::avx2) ? backend_t::avx2
+                                                 : backend_t::scalar);
+    return dispatch;
+}
+
+template <typename RaIter>
+void hash256_blocks(RaIter message_digest, const byte_t* data,
+                    std::size_t blocks) {
+    if (!blocks) return;
+    std::uint32_t state[8];
+    for (std::size_t i = 0; i < 8; ++i) {
+        state[i] = static_cast<std::uint32_t>(*(message_digest + i));
+    }
+    dispatch().compress(state, data, blocks);
+    for (std::size_t i = 0; i < 8; ++i) {
+        *(message_digest + i) = state[i];
+    }
+}
+
+// single message, straight from the caller's buffer
+inline void hash256_bytes(const byte_t* message, std::size_t size,
+                          byte_t* digest) {
+    std::uint32_t state[8];
+    for (std::size_t i = 0; i < 8; ++i) {
+        state[i] = static_cast<std::uint32_t>(initial_message_digest[i]);
+    }
+
+    byte_t tail[128];
+    const std::size_t tail_blocks = make_tail(message, size, tail);
+    const compress_t compress = dispatch().compress;
+    if (size / 64) compress(state, message, size / 64);
+    compress(state, tail, tail_blocks);
+
+    for (std::size_t i = 0; i < 8; ++i) {
+        store_be32(state[i], digest + 4 * i);
+    }
+}
+
 }  // namespace detail
 
+// the backend in use: sha_ni when the cpu has the sha extensions, avx2 (which
+// only speeds up hash256_batch) when it has avx2, scalar otherwise
+inline backend_t hash256_backend() { return detail::dispatch().backend; }
+
+// select a backend, e.g. to compare them. returns false if the cpu does not
+// support it. not thread safe: call it before hashing starts
+inline bool set_hash256_backend(backend_t backend) {
+    if (!detail::backend_supported(backend)) return false;
+    detail::dispatch() = detail::make_dispatch(backend);
+    return true;
+}
+
 template <typename InIter>
 void output_hex(InIter first, InIter last, std::ostream& os) {
     os.setf(std::ios::hex, std::ios::basefield);
@@ -155,9 +549,13 @@ void output_hex(InIter first, InIter last, std::ostream& os) {
 
 template <typename InIter>
 void bytes_to_hex_string(InIter first, InIter last, std::string& hex_str) {
-    std::ostringstream oss;
-    output_hex(first, last, oss);
-    hex_str.assign(oss.str());
+    static const char digits[] = "0123456789abcdef";
+    hex_str.clear();
+    for (; first != last; ++first) {
+        const unsigned int byte = static_cast<byte_t>(*first);
+        hex_str += digits[byte >> 4];
+        hex_str += digits[byte & 0xF];
+    }
 }
 
 template <typename InContainer>
@@ -194,11 +592,8 @@ class hash256_one_by_one {
     void process(RaIter first, RaIter last) {
         add_to_data_length(std::distance(first, last));
         std::copy(first, last, std::back_inserter(buffer_));
-        std::size_t i = 0;
-        for (; i + 64 <= buffer_.size(); i += 64) {
-            detail::hash256_block(h_, buffer_.begin() + i,
-                                  buffer_.begin() + i + 64);
-        }
+        const std::size_t i = buffer_.size() / 64 * 64;
+        if (i) detail::hash256_blocks(h_, &buffer_[0], i / 64);
         buffer_.erase(buffer_.begin(), buffer_.begin() + i);
     }
 
@@ -211,14 +606,14 @@ class hash256_one_by_one {
 
         if (remains > 55) {
             std::fill(temp + remains + 1, temp + 64, 0);
-            detail::hash256_block(h_, temp, temp + 64);
+            detail::hash256_blocks(h_, temp, 1);
             std::fill(temp, temp + 64 - 4, 0);
         } else {
             std::fill(temp + remains + 1, temp + 64 - 4, 0);
         }
 
         write_data_bit_length(&(temp[56]));
-        detail::hash256_block(h_, temp, temp + 64);
+        detail::hash256_blocks(h_, temp, 1);
     }
 
     template <typename OutIter>
@@ -344,9 +739,7 @@ template <typename InIter>
 void hash256_hex_string(InIter first, InIter last, std::string& hex_str) {
     byte_t hashed[32];
     hash256(first, last, hashed, hashed + 32);
-    std::ostringstream oss;
-    output_hex(hashed, hashed + 32, oss);
-    hex_str.assign(oss.str());
+    bytes_to_hex_string(hashed, hashed + 32, hex_str);
 }
 
 template <typename InIter>
@@ -357,7 +750,10 @@ std::string hash256_hex_string(InIter first, InIter last) {
 }
 
 inline void hash256_hex_string(const std::string& src, std::string& hex_str) {
-    hash256_hex_string(src.begin(), src.end(), hex_str);
+    byte_t hashed[32];
+    detail::hash256_bytes(reinterpret_cast<const byte_t*>(src.data()),
+                          src.size(), hashed);
+    bytes_to_hex_string(hashed, hashed + 32, hex_str);
 }
 
 template <typename InContainer>
@@ -370,6 +766,77 @@ std::string hash256_hex_string(const InContainer& src) {
     return hash256_hex_string(src.begin(), src.end());
 }
 
+// hash count messages into digests[0..count). with the avx2 backend eight
+// messages are hashed at a time, otherwise they are hashed one by one
+inline void hash256_batch(const byte_t* const* messages,
+                          const std::size_t* sizes, std::size_t count,
+                          byte_t (*digests)[32]) {
+#ifdef PICOSHA2_X86
+    if (hash256_backend() == backend_t::avx2) {
+        for (std::size_t i = 0; i < count; i += 8) {
+            const byte_t* lane_messages[8];
+            std::size_t lane_sizes[8];
+            byte_t(*lane_digests[8])[32];
+            for (std::size_t lane = 0; lane < 8; ++lane) {
+                const bool used = i + lane < count;
+                lane_messages[lane] = used ? messages[i + lane] : nullptr;
+                lane_sizes[lane] = used ? sizes[i + lane] : 0;
+                lane_digests[lane] = used ? &digests[i + lane] : nullptr;
+            }
+            detail::hash256_x8(lane_messages, lane_sizes, lane_digests);
+        }
+        return;
+    }
+#endif
+    for (std::size_t i = 0; i < count; ++i) {
+        detail::hash256_bytes(messages[i], sizes[i], digests[i]);
+    }
+}
+
+inline void hash256_batch(const std::vector<std::string>& src,
+                          std::vector<std::vector<byte_t> >& dst) {
+    std::vector<const byte_t*> messages(src.size());
+    std::vector<std::size_t> sizes(src.size());
+    for (std::size_t i = 0; i < src.size(); ++i) {
+        messages[i] = reinterpret_cast<const byte_t*>(src[i].data());
+        sizes[i] = src[i].size();
+    }
+
+    std::vector<byte_t> hashed(src.size() * 32);
+    hash256_batch(messages.data(), sizes.data(), src.size(),
+                  reinterpret_cast<byte_t(*)[32]>(hashed.data()));
+
+    dst.resize(src.size());
+    for (std::size_t i = 0; i < src.size(); ++i) {
+        dst[i].assign(hashed.begin() + i * 32, hashed.begin() + i * 32 + 32);
+    }
+}
+
+inline void hash256_hex_string_batch(const std::vector<std::string>& src,
+                                     std::vector<std::string>& hex_strs) {
+    static const char digits[] = "0123456789abcdef";
+
+    std::vector<const byte_t*> messages(src.size());
+    std::vector<std::size_t> sizes(src.size());
+    for (std::size_t i = 0; i < src.size(); ++i) {
+        messages[i] = reinterpret_cast<const byte_t*>(src[i].data());
+        sizes[i] = src[i].size();
+    }
+
+    std::vector<byte_t> hashed(src.size() * 32);
+    hash256_batch(messages.data(), sizes.data(), src.size(),
+                  reinterpret_cast<byte_t(*)[32]>(hashed.data()));
+
+    hex_strs.resize(src.size());
+    for (std::size_t i = 0; i < src.size(); ++i) {
+        hex_strs[i].resize(64);
+        for (std::size_t j = 0; j < 32; ++j) {
+            hex_strs[i][2 * j] = digits[hashed[i * 32 + j] >> 4];
+            hex_strs[i][2 * j + 1] = digits[hashed[i * 32 + j] & 0xF];
+        }
+    }
+}
+
 }  // namespace picosha2
 
 #endif  // PICOSHA2_H
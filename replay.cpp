@@ -0,0 +1,283 @@
+//---------------------------------------------------------- -
+//Copyright(c) 2020. Tawanda M.Nyoni(hkay dot tee at outlook dot com)
+//
+//This file is part of the Hlib library which is released
+//under the Creative Commons Attribution Non - Commercial
+//2.0 Generic license(CC BY - NC 2.0).
+//
+//See accompanying file CC - BY - NC - 2.0.txt
+//----------------------------------------------------------------------------------
+
+// hlib replay
+//
+// re-runs a trace written by hbase::start_capture against a copy of the
+// database and compares the latencies with those in the trace. every thread of
+// the trace gets a thread of its own, which runs its statements in order at
+// their original times divided by --speed; --speed=0 runs them back to back.
+// the statements of all the threads share one connection, as they did when
+// they were captured.
+//
+// usage: hlib_replay --trace=file --db=file [--copy=file] [--password=...]
+//                    [--speed=1] [--top=20]
+//
+// the copy is made with an online backup and defaults to the database's name
+// with .replay appended. values of a trace captured with hash_values are
+// replayed as NULL.
+
+#include "hlib.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+
+using namespace hlib;
+
+namespace {
+	using clock_ = std::chrono::steady_clock;
+
+	struct options_ {
+		std::string trace;
+		std::string db;
+		std::string copy;
+		std::string password;
+		double speed = 1;
+		size_t top = 20;
+	};
+
+	// the outcome of one replayed record
+	struct result_ {
+		long long duration_ns = 0;
+		bool success = true;
+		std::string error;
+	};
+
+	bool parse_options(int argc, char* argv[], options_& options) {
+		for (int i = 1; i < argc; i++) {
+			const std::string arg = argv[i];
+			const auto idx = arg.find('=');
+			const std::string name = arg.substr(0, idx);
+			const std::string value = idx == std::string::npos ? "" : arg.substr(idx + 1);
+
+			if (name == "--trace")
+				options.trace = value;
+			else
+				if (name == "--db")
+					options.db = value;
+				else
+					if (name == "--copy")
+						options.copy = value;
+					else
+						if (name == "--password")
+							options.password = value;
+						else
+							if (name == "--speed")
+								options.speed = std::stod(value);
+							else
+								if (name == "--top")
+									options.top = std::stoul(value);
+								else {
+									std::cerr << "unknown option " << arg << std::endl;
+									return false;
+								}
+		}
+
+		if (options.trace.empty() || options.db.empty()) {
+			std::cerr << "usage: hlib_replay --trace=file --db=file [--copy=file] [--password=...] [--speed=1] [--top=20]" << std::endl;
+			return false;
+		}
+
+		if (options.copy.empty())
+			options.copy = options.db + ".replay";
+		return true;
+	}
+
+	bool copy_database(const options_& options, std::string& error) {
+		std::remove(options.copy.c_str());
+
+		hbase source;
+		hbase::file_ file;
+		file.name = options.db;
+		file.password = options.password;
+		std::vector<hbase::table_> tables;
+
+		return source.connect(file, tables, error) &&
+			source.backup_to(options.copy, 0, nullptr, error);
+	}
+
+	void replay_thread(hbase& db,
+		const std::vector<hbase::trace_record_>& records,
+		const std::vector<size_t>& indexes,
+		double speed,
+		clock_::time_point start,
+		std::vector<result_>& results) {
+		for (const auto index : indexes) {
+			const auto& record = records[index];
+			if (speed > 0)
+				std::this_thread::sleep_until(start +
+					std::chrono::nanoseconds(static_cast<long long>(record.start_ns / speed)));
+
+			const std::string statement = hbase::replay_statement(record);
+			hbase::table rows;
+			auto& result = results[index];
+
+			const auto begin = clock_::now();
+			result.success = db.get_records_using_custom_query(rows, statement, result.error);
+			result.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_::now() - begin).count();
+		}
+	}
+
+	double percentile(std::vector<long long>& values, double p) {
+		if (values.empty())
+			return 0;
+
+		std::sort(values.begin(), values.end());
+		const size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+		return values[index] / 1e6;
+	}
+
+	struct latencies_ {
+		std::vector<long long> original;
+		std::vector<long long> replay;
+		long long original_total = 0;
+		long long replay_total = 0;
+		size_t errors = 0;
+	};
+
+	void report_line(const std::string& name, latencies_& latencies) {
+		const double original = latencies.original_total / 1e6;
+		const double replay = latencies.replay_total / 1e6;
+
+		std::cout << std::fixed << std::setprecision(3)
+			<< std::setw(8) << latencies.original.size()
+			<< std::setw(10) << percentile(latencies.original, 0.5)
+			<< std::setw(10) << percentile(latencies.original, 0.99)
+			<< std::setw(12) << original
+			<< std::setw(10) << percentile(latencies.replay, 0.5)
+			<< std::setw(10) << percentile(latencies.replay, 0.99)
+			<< std::setw(12) << replay
+			<< std::setw(8) << std::setprecision(2) << (original > 0 ? replay / original : 0)
+			<< std::setw(7) << latencies.errors
+			<< "  " << name << std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	options_ options;
+	if (!parse_options(argc, argv, options))
+		return 1;
+
+	std::string error;
+	std::vector<hbase::trace_record_> records;
+	if (!hbase::read_trace(options.trace, records, error)) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	if (!copy_database(options, error)) {
+		std::cerr << "cannot copy " << options.db << ": " << error << std::endl;
+		return 1;
+	}
+
+	hbase db;
+	hbase::file_ file;
+	file.name = options.copy;
+	file.password = options.password;
+	std::vector<hbase::table_> tables;
+	if (!db.connect(file, tables, error)) {
+		std::cerr << "cannot open " << options.copy << ": " << error << std::endl;
+		return 1;
+	}
+
+	// the records of each captured thread, in the order they started
+	std::map<unsigned, std::vector<size_t>> threads;
+	size_t hashed = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		threads[records[i].thread].push_back(i);
+		for (const auto& value : records[i].values)
+			if (value.kind == hbase::trace_value_::kind_::hash) {
+				hashed++;
+				break;
+			}
+	}
+
+	for (auto& thread : threads)
+		std::stable_sort(thread.second.begin(), thread.second.end(), [&](size_t a, size_t b) {
+			return records[a].start_ns < records[b].start_ns;
+			});
+
+	std::vector<result_> results(records.size());
+	const auto start = clock_::now();
+	{
+		std::vector<std::thread> workers;
+		for (const auto& thread : threads)
+			workers.emplace_back(replay_thread, std::ref(db), std::cref(records),
+				std::cref(thread.second), options.speed, start, std::ref(results));
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+	const double wall_ms = std::chrono::duration_cast<std::chrono::microseconds>(clock_::now() - start).count() / 1000.0;
+
+	// an error only counts when the statement succeeded in the capture
+	std::map<std::string, latencies_> shapes;
+	latencies_ overall;
+	std::string first_error;
+	for (size_t i = 0; i < records.size(); i++) {
+		const auto& record = records[i];
+		const auto& result = results[i];
+		const bool failed = record.success && !result.success;
+		if (failed && first_error.empty())
+			first_error = hbase::replay_statement(record) + ": " + result.error;
+
+		for (auto* latencies : { &shapes[record.statement], &overall }) {
+			latencies->original.push_back(record.duration_ns);
+			latencies->replay.push_back(result.duration_ns);
+			latencies->original_total += record.duration_ns;
+			latencies->replay_total += result.duration_ns;
+			latencies->errors += failed ? 1 : 0;
+		}
+	}
+
+	long long captured_ns = 0;
+	for (const auto& record : records)
+		captured_ns = std::max(captured_ns, record.start_ns + record.duration_ns);
+
+	std::cout << records.size() << " operations on " << threads.size() << " threads, "
+		<< std::fixed << std::setprecision(1) << captured_ns / 1e6 << " ms captured, "
+		<< wall_ms << " ms replayed";
+	if (options.speed > 0)
+		std::cout << " at " << options.speed << "x";
+	std::cout << std::endl;
+
+	if (hashed)
+		std::cout << hashed << " operations had hashed values, replayed as NULL" << std::endl;
+
+	std::cout << std::endl << "all times in ms; ratio is replay total over original total" << std::endl
+		<< std::setw(8) << "calls"
+		<< std::setw(10) << "orig p50" << std::setw(10) << "orig p99" << std::setw(12) << "orig total"
+		<< std::setw(10) << "new p50" << std::setw(10) << "new p99" << std::setw(12) << "new total"
+		<< std::setw(8) << "ratio" << std::setw(7) << "errors" << "  statement" << std::endl;
+
+	// the shapes that took longest in the capture
+	std::vector<std::map<std::string, latencies_>::iterator> order;
+	for (auto it = shapes.begin(); it != shapes.end(); ++it)
+		order.push_back(it);
+	std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) {
+		return a->second.original_total > b->second.original_total;
+		});
+	if (order.size() > options.top)
+		order.resize(options.top);
+
+	for (auto& it : order)
+		report_line(it->first, it->second);
+	report_line("(all)", overall);
+
+	if (!first_error.empty())
+		std::cout << std::endl << "first error: " << first_error << std::endl;
+
+	return 0;
+}
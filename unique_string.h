@@ -1,38 +1,217 @@
 #pragma once
 
-#include <rpc.h>
+#include <chrono>
+#include <cstdint>
+#include <random>
 #include <string>
-#include <iostream>
+#include <thread>
 #include "hlib.h"
 
-#pragma comment(lib, "rpcrt4.lib")
+// unique ids without the RPC runtime. every thread has its own generator so no
+// locks are taken, and the char buffer overloads do not allocate.
+//
+// uuid_v4: 36 character random uuid, in the format of UuidToStringA
+// uuid_v7: 36 character uuid that starts with the unix time in milliseconds
+// time_ordered_id: 16 character id (48 bit time, 32 bit random, crockford base 32)
+//
+// v7 uuids and time ordered ids generated later sort after the ones generated
+// before them, so primary keys made from them are appended to the end of the
+// b-tree instead of being inserted at random places.
 
-std::string unique_string() {
-	std::string string_uuid;
+namespace hlib {
+	namespace detail {
+		// xoshiro256** seeded from std::random_device, the thread id and the clock
+		class random_engine {
+			std::uint64_t s_[4];
 
-	UUID uuid;
-	UuidCreate(&uuid);
+			static std::uint64_t rotl(std::uint64_t x, int k) {
+				return (x << k) | (x >> (64 - k));
+			}
 
-	RPC_CSTR uuid_string;
-	RPC_STATUS status = UuidToStringA(&uuid, &uuid_string);
-	string_uuid += reinterpret_cast<char*>(uuid_string);
-	RpcStringFreeA(&uuid_string);
+			static std::uint64_t splitmix(std::uint64_t& x) {
+				std::uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+				return z ^ (z >> 31);
+			}
 
-	return string_uuid;
+		public:
+			random_engine() {
+				std::random_device device;
+				std::uint64_t seed = (static_cast<std::uint64_t>(device()) << 32) ^ device();
+				seed ^= std::hash<std::thread::id>()(std::this_thread::get_id());
+				seed ^= static_cast<std::uint64_t>(
+					std::chrono::high_resolution_clock::now().time_since_epoch().count());
+
+				for (auto& s : s_)
+					s = splitmix(seed);
+			}
+
+			std::uint64_t next() {
+				const std::uint64_t result = rotl(s_[1] * 5, 7) * 9;
+				const std::uint64_t t = s_[1] << 17;
+
+				s_[2] ^= s_[0];
+				s_[3] ^= s_[1];
+				s_[1] ^= s_[2];
+				s_[0] ^= s_[3];
+				s_[2] ^= t;
+				s_[3] = rotl(s_[3], 45);
+
+				return result;
+			}
+		};
+
+		inline random_engine& engine() {
+			thread_local random_engine engine;
+			return engine;
+		}
+
+		inline std::uint64_t unix_milliseconds() {
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count());
+		}
+
+		// two lower case hex digits for every byte value
+		struct hex_table {
+			char pairs[512];
+
+			constexpr hex_table() : pairs() {
+				const char digits[] = "0123456789abcdef";
+				for (int i = 0; i < 256; i++) {
+					pairs[2 * i] = digits[i >> 4];
+					pairs[2 * i + 1] = digits[i & 0xF];
+				}
+			}
+		};
+
+		constexpr hex_table hex = hex_table();
+
+		// write the 16 bytes in hi and lo as 8-4-4-4-12 hex digits
+		inline void format_uuid(std::uint64_t hi, std::uint64_t lo, char* out) {
+			unsigned char bytes[16];
+			for (int i = 0; i < 8; i++) {
+				bytes[i] = static_cast<unsigned char>(hi >> (56 - 8 * i));
+				bytes[8 + i] = static_cast<unsigned char>(lo >> (56 - 8 * i));
+			}
+
+			for (int i = 0; i < 16; i++) {
+				if (i == 4 || i == 6 || i == 8 || i == 10)
+					*out++ = '-';
+
+				*out++ = hex.pairs[2 * bytes[i]];
+				*out++ = hex.pairs[2 * bytes[i] + 1];
+			}
+			*out = '\0';
+		}
+
+		// state for keeping ids from one thread strictly increasing within a millisecond
+		struct sequence {
+			std::uint64_t time = 0;
+			std::uint64_t counter = 0;
+		};
+
+		inline sequence& v7_sequence() {
+			thread_local sequence state;
+			return state;
+		}
+
+		inline sequence& short_sequence() {
+			thread_local sequence state;
+			return state;
+		}
+	}
+}
+
+inline void uuid_v4(char(&buffer)[37]) {
+	auto& engine = hlib::detail::engine();
+
+	std::uint64_t hi = engine.next(), lo = engine.next();
+	hi = (hi & 0xFFFFFFFFFFFF0FFFULL) | 0x0000000000004000ULL;	// version 4
+	lo = (lo & 0x3FFFFFFFFFFFFFFFULL) | 0x8000000000000000ULL;	// variant 1
+
+	hlib::detail::format_uuid(hi, lo, buffer);
 }
 
-std::string unique_short_string() {
-	std::string uuid = unique_string();
+inline void uuid_v7(char(&buffer)[37]) {
+	auto& engine = hlib::detail::engine();
+	auto& sequence = hlib::detail::v7_sequence();
 
-	const auto idx = uuid.find('-');
-	if (idx != std::string::npos)
-		return uuid.substr(0, idx);
+	// the 12 bits after the version count up within a millisecond, starting
+	// from a random value in the lower half so there is room to count
+	std::uint64_t time = hlib::detail::unix_milliseconds();
+	if (time > sequence.time) {
+		sequence.time = time;
+		sequence.counter = engine.next() & 0x7FF;
+	}
 	else
-		return uuid;
+		if (++sequence.counter > 0xFFF) {
+			// counter exhausted (or the clock went back), borrow the next millisecond
+			sequence.time++;
+			sequence.counter = engine.next() & 0x7FF;
+		}
+
+	const std::uint64_t hi = ((sequence.time & 0xFFFFFFFFFFFFULL) << 16) | 0x7000 | sequence.counter;
+	const std::uint64_t lo = (engine.next() & 0x3FFFFFFFFFFFFFFFULL) | 0x8000000000000000ULL;
+
+	hlib::detail::format_uuid(hi, lo, buffer);
 }
 
-std::string custom_uid(std::string prefix) {
-	return prefix.append(unique_short_string());
+inline void time_ordered_id(char(&buffer)[17]) {
+	// crockford base 32, in ascending ascii order so ids sort like their values
+	static const char digits[] = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+
+	auto& engine = hlib::detail::engine();
+	auto& sequence = hlib::detail::short_sequence();
+
+	std::uint64_t time = hlib::detail::unix_milliseconds();
+	if (time > sequence.time) {
+		sequence.time = time;
+		sequence.counter = engine.next() & 0x7FFFFFFF;
+	}
+	else
+		if (++sequence.counter > 0xFFFFFFFF) {
+			sequence.time++;
+			sequence.counter = engine.next() & 0x7FFFFFFF;
+		}
+
+	// 80 bits: 48 bits of time followed by the 32 bit counter
+	const std::uint64_t hi = sequence.time & 0xFFFFFFFFFFFFULL;
+	const std::uint64_t lo = sequence.counter;
+
+	for (int i = 0; i < 16; i++) {
+		const int shift = 75 - 5 * i;	// of the 5 bit group, counted from bit 0 of lo
+		std::uint64_t group;
+		if (shift >= 32)
+			group = hi >> (shift - 32);
+		else
+			group = (hi << (32 - shift)) | (lo >> shift);
+
+		buffer[i] = digits[group & 0x1F];
+	}
+	buffer[16] = '\0';
+}
+
+inline std::string unique_string() {
+	char buffer[37];
+	uuid_v4(buffer);
+	return buffer;
+}
+
+inline std::string unique_string_v7() {
+	char buffer[37];
+	uuid_v7(buffer);
+	return buffer;
+}
+
+inline std::string unique_short_string() {
+	char buffer[17];
+	time_ordered_id(buffer);
+	return buffer;
 }
 
-	
\ No newline at end of file
+inline std::string custom_uid(std::string prefix) {
+	char buffer[17];
+	time_ordered_id(buffer);
+	return prefix.append(buffer);
+}